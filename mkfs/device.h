@@ -50,6 +50,29 @@ class DeviceBase {
   }
 };
 
+// device that can process block requests asynchronously
+// requests must use registered buffers of the device, and data in these
+// buffers must not be touched until the requests are completed
+class AsyncDevice : public DeviceBase {
+ public:
+  // submit a request that reads data to registered buffer
+  virtual bool SubmitRead(std::size_t buf_index, std::size_t len,
+                          std::size_t offset) = 0;
+  // submit a request that writes data in registered buffer to device
+  virtual bool SubmitWrite(std::size_t buf_index, std::size_t len,
+                           std::size_t offset) = 0;
+  // wait for all submitted requests to complete
+  // returns false if any request failed
+  virtual bool Wait() = 0;
+
+  // get registered buffer by index
+  virtual std::uint8_t *buffer(std::size_t buf_index) = 0;
+  // number of registered buffers, also the max number of requests
+  virtual std::size_t queue_depth() const = 0;
+  // size of each registered buffer
+  virtual std::size_t buffer_size() const = 0;
+};
+
 using Device = DeviceBase;
 
 #endif  // GEEOS_MKFS_DEVICE_H_
@@ -0,0 +1,83 @@
+#include "elf.h"
+
+#include <cstring>
+
+namespace {
+
+// magic number of ELF
+constexpr std::uint32_t kElfMagic = 0x464c457f;
+// 32-bit objects, in 'e_ident'
+constexpr std::uint8_t kElfClass32 = 1;
+// little endian, in 'e_ident'
+constexpr std::uint8_t kElfData2LSB = 1;
+// executable file, in 'e_type'
+constexpr std::uint16_t kElfTypeExec = 2;
+// RISC-V, in 'e_machine'
+constexpr std::uint16_t kElfMachineRISCV = 0xf3;
+// loadable segment, in 'p_type'
+constexpr std::uint32_t kElfProgLoad = 1;
+
+struct Elf32Ehdr {
+  std::uint32_t magic;
+  std::uint8_t  ident[12];
+  std::uint16_t type;
+  std::uint16_t machine;
+  std::uint32_t version;
+  std::uint32_t entry;
+  std::uint32_t phoff;
+  std::uint32_t shoff;
+  std::uint32_t flags;
+  std::uint16_t ehsize;
+  std::uint16_t phentsize;
+  std::uint16_t phnum;
+  std::uint16_t shentsize;
+  std::uint16_t shnum;
+  std::uint16_t shstrndx;
+};
+
+struct Elf32Phdr {
+  std::uint32_t type;
+  std::uint32_t offset;
+  std::uint32_t vaddr;
+  std::uint32_t paddr;
+  std::uint32_t filesz;
+  std::uint32_t memsz;
+  std::uint32_t flags;
+  std::uint32_t align;
+};
+
+}  // namespace
+
+bool ParseExecutable(std::string_view data, std::size_t size,
+                     PreloadEntry &entry) {
+  // check ELF header
+  Elf32Ehdr ehdr;
+  if (data.size() < sizeof(ehdr)) return false;
+  std::memcpy(&ehdr, data.data(), sizeof(ehdr));
+  if (ehdr.magic != kElfMagic || ehdr.ident[0] != kElfClass32 ||
+      ehdr.ident[1] != kElfData2LSB || ehdr.type != kElfTypeExec ||
+      ehdr.machine != kElfMachineRISCV ||
+      ehdr.phentsize < sizeof(Elf32Phdr) ||
+      ehdr.phoff > data.size() ||
+      (data.size() - ehdr.phoff) / ehdr.phentsize < ehdr.phnum) {
+    return false;
+  }
+  // count loadable segments, which must be inside the file
+  std::uint16_t load_num = 0;
+  for (std::size_t i = 0; i < ehdr.phnum; ++i) {
+    Elf32Phdr phdr;
+    std::memcpy(&phdr, data.data() + ehdr.phoff + i * ehdr.phentsize,
+                sizeof(phdr));
+    if (phdr.type != kElfProgLoad) continue;
+    if (phdr.offset > size || phdr.filesz > size - phdr.offset) {
+      return false;
+    }
+    ++load_num;
+  }
+  entry.size = size;
+  entry.entry = ehdr.entry;
+  entry.phoff = ehdr.phoff;
+  entry.phnum = ehdr.phnum;
+  entry.load_num = load_num;
+  return true;
+}
@@ -0,0 +1,17 @@
+#ifndef GEEOS_MKFS_ELF_H_
+#define GEEOS_MKFS_ELF_H_
+
+#include <string_view>
+#include <cstddef>
+#include <cstdint>
+
+#include "structs.h"
+
+// check if a file of 'size' bytes is a RISC-V 32-bit executable, which
+// can be loaded by the kernel, and fill the ELF part of preload entry
+// 'data' is the beginning of file, which must contain the program headers
+// 'inode_id' & 'first_block' of entry are not touched
+bool ParseExecutable(std::string_view data, std::size_t size,
+                     PreloadEntry &entry);
+
+#endif  // GEEOS_MKFS_ELF_H_
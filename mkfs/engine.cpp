@@ -0,0 +1,1285 @@
+#include "engine.h"
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+#include <string>
+#include <iomanip>
+#include <cstring>
+#include <cassert>
+
+#include "layout.h"
+#include "trace.h"
+
+namespace {
+
+const char *kTypeStr[] = {"unused", "file", "dir"};
+
+void PrintFileSize(std::ostream &os, std::size_t size) {
+  if (size < 1024) {
+    os << size << 'B';
+  }
+  else {
+    os << std::fixed << std::setprecision(1);
+    if (size < 1024 * 1024) {
+      os << size / 1024.0 << 'K';
+    }
+    else if (size < 1024 * 1024 * 1024) {
+      os << size / 1024.0 / 1024.0 << 'M';
+    }
+    else {
+      os << size / 1024.0 / 1024.0 / 1024.0 << 'G';
+    }
+  }
+}
+
+// hash function of file names in indexed directories (32-bit FNV-1a)
+std::uint32_t HashName(std::string_view name) {
+  std::uint32_t hash = 2166136261u;
+  for (const auto &c : name) {
+    hash ^= static_cast<std::uint8_t>(c);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+// get a small integer that identifies current thread
+// threads use it to pick different allocation groups
+std::size_t GetThreadSlot() {
+  static std::atomic<std::size_t> next_slot(0);
+  thread_local auto slot = next_slot++;
+  return slot;
+}
+
+// size of buffer used when writing contiguous data blocks
+constexpr std::size_t kExtentBufferSize = 64 * 1024;
+
+// check if all bytes of data are zero
+bool IsZeroData(const std::uint8_t *data, std::size_t len) {
+  return !len || (!data[0] && !std::memcmp(data, data + 1, len - 1));
+}
+
+}  // namespace
+
+template <typename Layout>
+void GeeFSEngine<Layout>::InitLocks() {
+  groups_ = std::make_unique<AllocGroup[]>(super_block_.free_map_num);
+  for (std::size_t i = 0; i < super_block_.free_map_num; ++i) {
+    groups_[i].hint = sizeof(FreeMapBlockHeader);
+  }
+  inode_blk_locks_ =
+      std::make_unique<std::mutex[]>(super_block_.inode_blk_num);
+  inode_hint_ = 0;
+  dir_locks_.clear();
+}
+
+template <typename Layout>
+std::mutex &GeeFSEngine<Layout>::GetDirLock(std::uint32_t id) {
+  std::lock_guard<std::mutex> lock(dir_locks_lock_);
+  auto &dir_lock = dir_locks_[id];
+  if (!dir_lock) dir_lock = std::make_unique<std::mutex>();
+  return *dir_lock;
+}
+
+template <typename Layout>
+std::optional<std::uint32_t> GeeFSEngine<Layout>::AllocDataBlock() {
+  auto buf = layout_.NewBuffer();
+  // traverse all allocation groups (free maps), starting from the group
+  // of current thread, so that threads allocate from different groups
+  const auto kGroupNum = super_block_.free_map_num;
+  const auto kFirst = GetThreadSlot() % kGroupNum;
+  for (std::size_t n = 0; n < kGroupNum; ++n) {
+    auto i = (kFirst + n) % kGroupNum;
+    auto &group = groups_[i];
+    std::lock_guard<std::mutex> lock(group.lock);
+    // read header of free map block
+    auto offset = BlockToOffset(1 + i);
+    FreeMapBlockHeader hdr;
+    auto ret = dev_.ReadAssert(sizeof(hdr), hdr, offset);
+    static_cast<void>(ret);
+    assert(ret);
+    // check for free blocks
+    if (hdr.unused_num) {
+      // update header
+      --hdr.unused_num;
+      ret = dev_.WriteAssert(sizeof(hdr), hdr, offset);
+      assert(ret);
+      // read free map after hint, bytes before hint are all allocated
+      auto len = buf.size() - group.hint;
+      ret = dev_.ReadAssert(len, buf.data() + group.hint, len,
+                            offset + group.hint);
+      assert(ret);
+      // find next free bit
+      for (auto j = group.hint; j < buf.size(); ++j) {
+        if (buf[j] == 0xff) continue;
+        group.hint = j;
+        for (int k = 7; k >= 0; --k) {
+          if (!(buf[j] & (1 << k))) {
+            // set free bit as allocated
+            buf[j] |= (1 << k);
+            // update free map
+            ret = dev_.WriteAssert(1, buf[j], offset + j);
+            assert(ret);
+            // return block offset
+            auto blk_ofs = 1 + super_block_.free_map_num;
+            blk_ofs += super_block_.inode_blk_num;
+            blk_ofs += i * blk_per_fmb();
+            blk_ofs += (j - sizeof(hdr)) * 8 + (7 - k);
+            return blk_ofs;
+          }
+        }
+      }
+      assert(false);
+    }
+  }
+  return {};
+}
+
+template <typename Layout>
+std::optional<std::uint32_t> GeeFSEngine<Layout>::AllocExtent(
+    std::size_t n) {
+  TraceSpan span("AllocExtent");
+  span.AddArg("blocks", n);
+  if (!n || n > blk_per_fmb()) return {};
+  auto buf = layout_.NewBuffer();
+  constexpr auto kHeaderSize = sizeof(FreeMapBlockHeader);
+  auto is_free = [&buf](std::size_t i) {
+    return !(buf[kHeaderSize + i / 8] & (0x80 >> (i % 8)));
+  };
+  for (std::size_t i = 0; i < super_block_.free_map_num; ++i) {
+    auto &group = groups_[i];
+    std::lock_guard<std::mutex> lock(group.lock);
+    // read free map block if there are enough free blocks
+    auto offset = BlockToOffset(1 + i);
+    FreeMapBlockHeader hdr;
+    if (!dev_.ReadAssert(sizeof(hdr), hdr, offset)) return {};
+    if (hdr.unused_num < n) continue;
+    if (!dev_.ReadAssert(buf.size(), buf.data(), buf.size(), offset)) {
+      return {};
+    }
+    // find the first run of free blocks, starting from hint
+    std::size_t j = (group.hint - kHeaderSize) * 8, run = 0;
+    for (; j < blk_per_fmb() && run < n; ++j) run = is_free(j) ? run + 1 : 0;
+    if (run < n) continue;
+    // set blocks as allocated & update free map
+    for (auto k = j - n; k < j; ++k) {
+      buf[kHeaderSize + k / 8] |= 0x80 >> (k % 8);
+    }
+    hdr.unused_num -= n;
+    std::memcpy(buf.data(), &hdr, sizeof(hdr));
+    if (!dev_.WriteAssert(buf.size(), buf.data(), buf.size(), offset)) {
+      return {};
+    }
+    // return offset of the first block
+    auto blk_ofs = 1 + super_block_.free_map_num;
+    blk_ofs += super_block_.inode_blk_num;
+    blk_ofs += i * blk_per_fmb() + j - n;
+    span.AddArg("block", blk_ofs);
+    return blk_ofs;
+  }
+  return {};
+}
+
+template <typename Layout>
+bool GeeFSEngine<Layout>::FreeDataBlock(std::uint32_t blk_ofs) {
+  read_ahead_.Invalidate();
+  // get position in free map
+  auto first_blk = 1 + super_block_.free_map_num + super_block_.inode_blk_num;
+  if (blk_ofs < first_blk) return false;
+  auto n = blk_ofs - first_blk;
+  if (n >= blk_per_fmb() * super_block_.free_map_num) return false;
+  auto offset = BlockToOffset(1 + n / blk_per_fmb());
+  auto byte_ofs = offset + sizeof(FreeMapBlockHeader) +
+                  (n % blk_per_fmb()) / 8;
+  auto bit = 1 << (7 - n % 8);
+  auto &group = groups_[n / blk_per_fmb()];
+  std::lock_guard<std::mutex> lock(group.lock);
+  group.hint = std::min(group.hint, byte_ofs - offset);
+  // update free bit
+  std::uint8_t byte;
+  if (!dev_.ReadAssert(1, byte, byte_ofs) || !(byte & bit)) return false;
+  // clear the block, since new owners may not overwrite the whole block,
+  // and all-zero blocks are skipped by sparse files & image encoders
+  auto buf = layout_.NewBuffer();
+  if (!dev_.WriteAssert(buf.size(), buf.data(), buf.size(),
+                        BlockToOffset(blk_ofs))) {
+    return false;
+  }
+  byte &= ~bit;
+  if (!dev_.WriteAssert(1, byte, byte_ofs)) return false;
+  // update header
+  FreeMapBlockHeader hdr;
+  if (!dev_.ReadAssert(sizeof(hdr), hdr, offset)) return false;
+  ++hdr.unused_num;
+  return dev_.WriteAssert(sizeof(hdr), hdr, offset);
+}
+
+template <typename Layout>
+bool GeeFSEngine<Layout>::FreeBlocks(INode &inode) {
+  // free data blocks
+  for (std::size_t i = 0; i < inode.block_num; ++i) {
+    auto blk_ofs = GetBlockOffset(inode, i);
+    if (!blk_ofs) return false;
+    // skip holes
+    if (*blk_ofs && !FreeDataBlock(*blk_ofs)) return false;
+  }
+  // free indirect block
+  if (inode.block_num > kDirectBlockNum) {
+    if (!FreeDataBlock(inode.indirect)) return false;
+  }
+  // free 2nd indirect block
+  if (inode.block_num > kDirectBlockNum + ofs_per_blk()) {
+    auto n = inode.block_num - kDirectBlockNum - ofs_per_blk();
+    auto ind_num = (n + ofs_per_blk() - 1) / ofs_per_blk();
+    for (std::size_t i = 0; i < ind_num; ++i) {
+      std::uint32_t ind_ofs;
+      auto offset = BlockToOffset(inode.indirect2) + i * kBlockOfsSize;
+      if (!dev_.ReadAssert(kBlockOfsSize, ind_ofs, offset) ||
+          !FreeDataBlock(ind_ofs)) {
+        return false;
+      }
+    }
+    if (!FreeDataBlock(inode.indirect2)) return false;
+  }
+  inode.block_num = 0;
+  return true;
+}
+
+template <typename Layout>
+std::optional<std::uint32_t> GeeFSEngine<Layout>::AllocINode(
+    INodeType type) {
+  TraceSpan span("AllocINode");
+  auto buf = layout_.NewBuffer();
+  // traverse inode blocks, blocks before hint are all full
+  for (std::uint32_t i = inode_hint_; i < super_block_.inode_blk_num; ++i) {
+    std::lock_guard<std::mutex> lock(inode_blk_locks_[i]);
+    // read inode block
+    auto offset = BlockToOffset(1 + super_block_.free_map_num + i);
+    auto ret = dev_.ReadAssert(buf.size(), buf.data(), buf.size(), offset);
+    static_cast<void>(ret);
+    assert(ret);
+    // check for free inodes
+    auto hdr = reinterpret_cast<INodeBlockHeader *>(buf.data());
+    if (hdr->unused_num) {
+      // update header
+      --hdr->unused_num;
+      ret = dev_.WriteAssert(sizeof(*hdr), *hdr, offset);
+      assert(ret);
+      // find next free inode
+      auto inodes = reinterpret_cast<INode *>(buf.data() + sizeof(*hdr));
+      for (int j = 0; j < in_per_blk(); ++j) {
+        if (inodes[j].type == INodeType::Unused) {
+          // mark as used, so that other threads will not pick it
+          std::uint32_t id = i * in_per_blk() + j;
+          INode inode = {type, 0, 1};
+          ret = dev_.WriteAssert(sizeof(inode), inode, GetINodeOffset(id));
+          assert(ret);
+          span.AddArg("inode", id);
+          return id;
+        }
+      }
+      assert(false);
+    }
+    // current block is full, try to move hint forward
+    auto hint = i;
+    inode_hint_.compare_exchange_strong(hint, i + 1);
+  }
+  return {};
+}
+
+template <typename Layout>
+void GeeFSEngine<Layout>::FreeINode(std::uint32_t id) {
+  auto i = id / in_per_blk();
+  std::lock_guard<std::mutex> lock(inode_blk_locks_[i]);
+  // mark as unused
+  INode inode = {INodeType::Unused};
+  auto ret = dev_.WriteAssert(sizeof(inode), inode, GetINodeOffset(id));
+  static_cast<void>(ret);
+  assert(ret);
+  // update header
+  auto offset = BlockToOffset(1 + super_block_.free_map_num + i);
+  INodeBlockHeader hdr;
+  ret = dev_.ReadAssert(sizeof(hdr), hdr, offset);
+  assert(ret);
+  ++hdr.unused_num;
+  ret = dev_.WriteAssert(sizeof(hdr), hdr, offset);
+  assert(ret);
+  // move hint backward
+  auto hint = inode_hint_.load();
+  while (i < hint && !inode_hint_.compare_exchange_weak(hint, i)) {}
+}
+
+template <typename Layout>
+void GeeFSEngine<Layout>::InitDirBlock(std::uint32_t blk_ofs,
+                                       std::uint32_t cur_id,
+                                       std::uint32_t parent_id) {
+  Entry ent[2] = {};
+  // entry '.'
+  ent[0].inode_id = cur_id;
+  std::strcpy(reinterpret_cast<char *>(ent[0].filename), ".");
+  // entry '..'
+  ent[1].inode_id = parent_id;
+  std::strcpy(reinterpret_cast<char *>(ent[1].filename), "..");
+  auto ret = dev_.WriteAssert(sizeof(ent), ent, BlockToOffset(blk_ofs));
+  static_cast<void>(ret);
+  assert(ret);
+}
+
+template <typename Layout>
+std::size_t GeeFSEngine<Layout>::GetINodeOffset(std::uint32_t id) const {
+  auto offset = BlockToOffset(1 + super_block_.free_map_num +
+                              id / in_per_blk());
+  return offset + sizeof(INodeBlockHeader) +
+         (id % in_per_blk()) * sizeof(INode);
+}
+
+template <typename Layout>
+void GeeFSEngine<Layout>::UpdateINode(const INode &inode,
+                                      std::uint32_t id) {
+  std::lock_guard<std::mutex> lock(inode_blk_locks_[id / in_per_blk()]);
+  auto ret = dev_.WriteAssert(sizeof(INode), inode, GetINodeOffset(id));
+  static_cast<void>(ret);
+  assert(ret);
+}
+
+template <typename Layout>
+bool GeeFSEngine<Layout>::ReadINode(INode &inode, std::uint32_t id) {
+  if (id >= in_per_blk() * super_block_.inode_blk_num) return false;
+  std::lock_guard<std::mutex> lock(inode_blk_locks_[id / in_per_blk()]);
+  return dev_.ReadAssert(sizeof(INode), inode, GetINodeOffset(id));
+}
+
+template <typename Layout>
+std::optional<std::uint32_t> GeeFSEngine<Layout>::ReadINode(
+    INode &inode, std::string_view name) {
+  Entry entry;
+  if (!FindEntry(name, entry) || !ReadINode(inode, entry.inode_id)) {
+    return {};
+  }
+  return entry.inode_id;
+}
+
+template <typename Layout>
+std::optional<std::uint32_t> GeeFSEngine<Layout>::GetBlockOffset(
+    const INode &inode, std::size_t n) {
+  if (n >= inode.block_num) return {};
+  if (n < kDirectBlockNum) return inode.direct[n];
+  // indirect block
+  std::uint32_t blk_ofs;
+  n -= kDirectBlockNum;
+  if (n < ofs_per_blk()) {
+    if (!read_ahead_.ReadPointer(inode.indirect, n, blk_ofs)) return {};
+    return blk_ofs;
+  }
+  // 2nd indirect block
+  n -= ofs_per_blk();
+  if (n >= ofs_per_blk() * ofs_per_blk()) return {};
+  if (!read_ahead_.ReadPointer(inode.indirect2, n / ofs_per_blk(),
+                               blk_ofs) ||
+      !read_ahead_.ReadPointer(blk_ofs, n % ofs_per_blk(), blk_ofs)) {
+    return {};
+  }
+  return blk_ofs;
+}
+
+template <typename Layout>
+bool GeeFSEngine<Layout>::AppendBlock(INode &inode, std::uint32_t blk_ofs) {
+  // pointer blocks may be modified
+  read_ahead_.Invalidate();
+  std::size_t n = inode.block_num++;
+  if (n < kDirectBlockNum) {
+    inode.direct[n] = blk_ofs;
+    return true;
+  }
+  // indirect block
+  n -= kDirectBlockNum;
+  if (n < ofs_per_blk()) {
+    if (!n) {
+      // allocate indirect block
+      auto blk_ofs = AllocDataBlock();
+      if (!blk_ofs) return false;
+      inode.indirect = *blk_ofs;
+    }
+    auto offset = BlockToOffset(inode.indirect) + n * kBlockOfsSize;
+    return dev_.WriteAssert(kBlockOfsSize, blk_ofs, offset);
+  }
+  // 2nd indirect block
+  n -= ofs_per_blk();
+  if (n >= ofs_per_blk() * ofs_per_blk()) return false;
+  if (!n) {
+    // allocate 2nd indirect block
+    auto blk_ofs = AllocDataBlock();
+    if (!blk_ofs) return false;
+    inode.indirect2 = *blk_ofs;
+  }
+  auto offset = BlockToOffset(inode.indirect2);
+  offset += (n / ofs_per_blk()) * kBlockOfsSize;
+  std::uint32_t ind_ofs;
+  if (!(n % ofs_per_blk())) {
+    // allocate a new indirect block in 2nd indirect block
+    auto blk_ofs = AllocDataBlock();
+    if (!blk_ofs) return false;
+    if (!dev_.WriteAssert(kBlockOfsSize, *blk_ofs, offset)) return false;
+    ind_ofs = *blk_ofs;
+  }
+  else {
+    if (!dev_.ReadAssert(kBlockOfsSize, ind_ofs, offset)) return false;
+  }
+  offset = BlockToOffset(ind_ofs) + (n % ofs_per_blk()) * kBlockOfsSize;
+  return dev_.WriteAssert(kBlockOfsSize, blk_ofs, offset);
+}
+
+template <typename Layout>
+bool GeeFSEngine<Layout>::SetBlockOffset(INode &inode, std::size_t n,
+                                         std::uint32_t blk_ofs) {
+  if (n >= inode.block_num) return false;
+  if (n < kDirectBlockNum) {
+    inode.direct[n] = blk_ofs;
+    return true;
+  }
+  // pointer blocks will be modified
+  read_ahead_.Invalidate();
+  // indirect block
+  n -= kDirectBlockNum;
+  if (n < ofs_per_blk()) {
+    auto offset = BlockToOffset(inode.indirect) + n * kBlockOfsSize;
+    return dev_.WriteAssert(kBlockOfsSize, blk_ofs, offset);
+  }
+  // 2nd indirect block
+  n -= ofs_per_blk();
+  std::uint32_t ind_ofs;
+  auto offset = BlockToOffset(inode.indirect2);
+  offset += (n / ofs_per_blk()) * kBlockOfsSize;
+  if (!dev_.ReadAssert(kBlockOfsSize, ind_ofs, offset)) return false;
+  offset = BlockToOffset(ind_ofs) + (n % ofs_per_blk()) * kBlockOfsSize;
+  return dev_.WriteAssert(kBlockOfsSize, blk_ofs, offset);
+}
+
+template <typename Layout>
+bool GeeFSEngine<Layout>::MoveInlineData(INode &inode) {
+  // copy inline data to buffer, then clear block pointers
+  auto buf = layout_.NewBuffer();
+  std::memcpy(buf.data(), GetInlineData(inode), inode.size);
+  std::memset(GetInlineData(inode), 0, kInlineDataSize);
+  inode.flags &= ~kINodeFlagInline;
+  inode.block_num = 0;
+  if (!inode.size) return true;
+  // write to a new data block
+  auto blk_ofs = AllocDataBlock();
+  return blk_ofs && AppendBlock(inode, *blk_ofs) &&
+         dev_.WriteAssert(buf.size(), buf.data(), buf.size(),
+                          BlockToOffset(*blk_ofs));
+}
+
+template <typename Layout>
+bool GeeFSEngine<Layout>::EnableFeature(std::uint32_t feature) {
+  std::lock_guard<std::mutex> lock(super_block_lock_);
+  if (super_block_.features & feature) return true;
+  super_block_.features |= feature;
+  // header of older images does not contain 'features'
+  super_block_.header_size = sizeof(SuperBlockHeader);
+  return dev_.WriteAssert(sizeof(super_block_), super_block_, 0);
+}
+
+template <typename Layout>
+bool GeeFSEngine<Layout>::WalkEntry(
+    std::function<bool(const Entry &)> callback) {
+  TraceSpan span("WalkEntry");
+  span.AddArg("blocks", cwd_.block_num);
+  assert(cwd_.type == INodeType::Dir);
+  const auto kEntNum = cwd_.size / sizeof(Entry);
+  const auto kIndexed = cwd_.flags & kINodeFlagIndexed;
+  auto buf = layout_.NewBuffer();
+  auto entries = reinterpret_cast<const Entry *>(buf.data());
+  // traverse data blocks, skip index block if indexed
+  for (int i = kIndexed ? 1 : 0; i < cwd_.block_num; ++i) {
+    // read the whole block
+    auto blk_ofs = GetBlockOffset(cwd_, i);
+    if (!blk_ofs) return false;
+    auto len = kIndexed ? buf.size() :
+               std::min(kEntNum - i * ent_per_blk(), ent_per_blk()) *
+               sizeof(Entry);
+    if (!dev_.ReadAssert(len, buf.data(), len, BlockToOffset(*blk_ofs))) {
+      return false;
+    }
+    // get range of entries
+    std::size_t first = 0, last = len / sizeof(Entry);
+    if (kIndexed) {
+      auto hdr = reinterpret_cast<const BucketBlockHeader *>(buf.data());
+      first = 1;
+      last = 1 + hdr->entry_num;
+    }
+    // traverse entries in current block
+    for (auto j = first; j < last; ++j) {
+      // invoke callback function
+      if (!callback(entries[j])) return false;
+    }
+  }
+  return true;
+}
+
+template <typename Layout>
+bool GeeFSEngine<Layout>::FindEntry(std::string_view name, Entry &entry) {
+  if (name.size() > kFileNameMaxLen - 1) return false;
+  // linear search in non-indexed directory
+  if (!(cwd_.flags & kINodeFlagIndexed)) {
+    bool found = false;
+    WalkEntry([&name, &entry, &found](const Entry &ent) {
+      if (name == reinterpret_cast<const char *>(ent.filename)) {
+        entry = ent;
+        found = true;
+        return false;
+      }
+      return true;
+    });
+    return found;
+  }
+  // get the first block in bucket
+  auto offset = GetBucketOffset(name);
+  std::uint32_t blk_ofs;
+  if (!offset || !dev_.ReadAssert(kBlockOfsSize, blk_ofs, *offset)) {
+    return false;
+  }
+  // traverse all blocks in bucket
+  auto buf = layout_.NewBuffer();
+  auto hdr = reinterpret_cast<const BucketBlockHeader *>(buf.data());
+  auto entries = reinterpret_cast<const Entry *>(buf.data());
+  while (blk_ofs) {
+    if (!dev_.ReadAssert(buf.size(), buf.data(), buf.size(),
+                         BlockToOffset(blk_ofs))) {
+      return false;
+    }
+    for (std::size_t i = 1; i <= hdr->entry_num; ++i) {
+      if (name == reinterpret_cast<const char *>(entries[i].filename)) {
+        entry = entries[i];
+        return true;
+      }
+    }
+    blk_ofs = hdr->next;
+  }
+  return false;
+}
+
+template <typename Layout>
+bool GeeFSEngine<Layout>::AddEntry(std::uint32_t inode_id,
+                                   std::string_view file_name) {
+  if (file_name.size() > kFileNameMaxLen - 1) return false;
+  // check if conflicted
+  Entry entry = {};
+  if (FindEntry(file_name, entry)) return false;
+  // initialize new entry
+  entry.inode_id = inode_id;
+  std::strcpy(reinterpret_cast<char *>(entry.filename),
+              std::string(file_name).c_str());
+  if (cwd_.flags & kINodeFlagIndexed) {
+    // insert entry to bucket
+    if (!AddIndexedEntry(entry)) return false;
+  }
+  else {
+    // get offset of entry that will be inserted
+    auto blk_ofs = GetBlockOffset(cwd_, cwd_.block_num - 1);
+    if (!blk_ofs) return false;
+    auto offset = BlockToOffset(*blk_ofs);
+    auto ent_count = cwd_.size / sizeof(Entry);
+    assert(ent_count != 0);
+    auto inblk_ofs = (ent_count % ent_per_blk()) * sizeof(Entry);
+    if (inblk_ofs) {
+      offset += inblk_ofs;
+    }
+    else {
+      // allocate new block
+      auto blk_ofs = AllocDataBlock();
+      if (!blk_ofs || !AppendBlock(cwd_, *blk_ofs)) return false;
+      offset = BlockToOffset(*blk_ofs);
+    }
+    // insert entry
+    if (!dev_.WriteAssert(sizeof(Entry), entry, offset)) return false;
+  }
+  // update inode of cwd
+  cwd_.size += sizeof(Entry);
+  UpdateINode(cwd_, cwd_id_);
+  // convert to indexed directory if there are too many entries,
+  // or rebuild index if buckets are too long
+  if (cwd_.flags & kINodeFlagIndexed) {
+    if (NeedMoreBuckets()) return ConvertToIndexed();
+  }
+  else if (index_threshold_ && cwd_.size / sizeof(Entry) > index_threshold_) {
+    return ConvertToIndexed();
+  }
+  return true;
+}
+
+template <typename Layout>
+std::size_t GeeFSEngine<Layout>::GetBucketNum(std::size_t entry_num) const {
+  // make each bucket fit in a block
+  auto blk_num = (entry_num + ent_per_bucket_blk() - 1) /
+                 ent_per_bucket_blk();
+  std::size_t bucket_num = 1;
+  while (bucket_num < blk_num) bucket_num *= 2;
+  return std::min(bucket_num, max_bucket_num());
+}
+
+template <typename Layout>
+std::optional<std::size_t> GeeFSEngine<Layout>::GetBucketOffset(
+    std::string_view name) {
+  auto offset = BlockToOffset(cwd_.direct[0]);
+  IndexBlockHeader hdr;
+  if (!dev_.ReadAssert(sizeof(hdr), hdr, offset) || !hdr.bucket_num ||
+      hdr.bucket_num > max_bucket_num()) {
+    return {};
+  }
+  auto bucket = HashName(name) % hdr.bucket_num;
+  return offset + sizeof(hdr) + bucket * kBlockOfsSize;
+}
+
+template <typename Layout>
+bool GeeFSEngine<Layout>::NeedMoreBuckets() {
+  IndexBlockHeader hdr;
+  if (!dev_.ReadAssert(sizeof(hdr), hdr, BlockToOffset(cwd_.direct[0]))) {
+    return false;
+  }
+  // more than 2 blocks per bucket on average
+  auto entry_num = cwd_.size / sizeof(Entry);
+  return cwd_.block_num - 1 > 2 * hdr.bucket_num &&
+         GetBucketNum(entry_num) > hdr.bucket_num;
+}
+
+template <typename Layout>
+bool GeeFSEngine<Layout>::AddIndexedEntry(const Entry &entry) {
+  // get the first block in bucket
+  auto bucket_ofs =
+      GetBucketOffset(reinterpret_cast<const char *>(entry.filename));
+  std::uint32_t blk_ofs;
+  if (!bucket_ofs || !dev_.ReadAssert(kBlockOfsSize, blk_ofs, *bucket_ofs)) {
+    return false;
+  }
+  // try to insert to the first block
+  BucketBlockHeader hdr;
+  if (blk_ofs) {
+    auto offset = BlockToOffset(blk_ofs);
+    if (!dev_.ReadAssert(sizeof(hdr), hdr, offset)) return false;
+    if (hdr.entry_num < ent_per_bucket_blk()) {
+      offset += (1 + hdr.entry_num++) * sizeof(Entry);
+      return dev_.WriteAssert(sizeof(Entry), entry, offset) &&
+             dev_.WriteAssert(sizeof(hdr), hdr, BlockToOffset(blk_ofs));
+    }
+  }
+  // allocate a new block as the first block in bucket
+  auto new_blk = AllocDataBlock();
+  if (!new_blk || !AppendBlock(cwd_, *new_blk)) return false;
+  hdr = {blk_ofs, 1, {}};
+  auto offset = BlockToOffset(*new_blk);
+  return dev_.WriteAssert(sizeof(hdr), hdr, offset) &&
+         dev_.WriteAssert(sizeof(Entry), entry, offset + sizeof(Entry)) &&
+         dev_.WriteAssert(kBlockOfsSize, *new_blk, *bucket_ofs);
+}
+
+template <typename Layout>
+bool GeeFSEngine<Layout>::ConvertToIndexed() {
+  // read all entries of cwd
+  std::vector<Entry> entries;
+  entries.reserve(cwd_.size / sizeof(Entry));
+  auto ret = WalkEntry([&entries](const Entry &entry) {
+    entries.push_back(entry);
+    return true;
+  });
+  if (!ret) return false;
+  // release all blocks, then allocate an empty index block
+  // with just enough buckets for all entries
+  if (!FreeBlocks(cwd_)) return false;
+  auto blk_ofs = AllocDataBlock();
+  if (!blk_ofs || !AppendBlock(cwd_, *blk_ofs)) return false;
+  auto index_blk = layout_.NewBuffer();
+  IndexBlockHeader hdr = {
+      static_cast<std::uint32_t>(GetBucketNum(entries.size()))};
+  std::memcpy(index_blk.data(), &hdr, sizeof(hdr));
+  if (!dev_.WriteAssert(index_blk.size(), index_blk.data(), index_blk.size(),
+                        BlockToOffset(*blk_ofs))) {
+    return false;
+  }
+  cwd_.flags |= kINodeFlagIndexed;
+  // insert all entries to buckets
+  for (const auto &entry : entries) {
+    if (!AddIndexedEntry(entry)) return false;
+  }
+  UpdateINode(cwd_, cwd_id_);
+  return EnableFeature(kFeatureIndexedDir);
+}
+
+template <typename Layout>
+bool GeeFSEngine<Layout>::Create(std::uint32_t free_map_num,
+                                 std::uint32_t inode_blk_num) {
+  if (block_size() < sizeof(SuperBlockHeader) ||
+      block_size() - sizeof(INodeBlockHeader) < sizeof(INode) ||
+      block_size() < 2 * sizeof(Entry)) {
+    return false;
+  }
+  read_ahead_.Invalidate();
+  // resize device to image size
+  auto blk_num = 1 + free_map_num + inode_blk_num;
+  blk_num += blk_per_fmb() * free_map_num;
+  if (!dev_.Resize(BlockToOffset(blk_num))) return false;
+  // create buffer of empty block
+  auto empty_blk = layout_.NewBuffer();
+  // initialize super block
+  super_block_ = {kMagicNum, sizeof(SuperBlockHeader), block_size(),
+                  free_map_num, inode_blk_num, 0, 0};
+  InitLocks();
+  if (!dev_.WriteAssert(block_size(), empty_blk.data(), block_size(), 0) ||
+      !dev_.WriteAssert(sizeof(super_block_), super_block_, 0)) {
+    return false;
+  }
+  // initialize free map
+  for (int i = 0; i < free_map_num; ++i) {
+    auto offset = BlockToOffset(1 + i);
+    if (!dev_.WriteAssert(block_size(), empty_blk.data(), block_size(),
+                          offset)) {
+      return false;
+    }
+    FreeMapBlockHeader hdr = {static_cast<std::uint32_t>(blk_per_fmb())};
+    if (!dev_.WriteAssert(sizeof(hdr), hdr, offset)) return false;
+  }
+  // initialize inode block
+  for (int i = 0; i < inode_blk_num; ++i) {
+    auto offset = BlockToOffset(1 + free_map_num + i);
+    if (!dev_.WriteAssert(block_size(), empty_blk.data(), block_size(),
+                          offset)) {
+      return false;
+    }
+    INodeBlockHeader hdr = {static_cast<std::uint32_t>(in_per_blk())};
+    if (!dev_.WriteAssert(sizeof(hdr), hdr, offset)) return false;
+  }
+  // initialize data blocks
+  auto data_blk_num = blk_per_fmb() * free_map_num;
+  for (int i = 0; i < data_blk_num; ++i) {
+    auto offset = BlockToOffset(1 + free_map_num + inode_blk_num + i);
+    if (!dev_.WriteAssert(block_size(), empty_blk.data(), block_size(),
+                          offset)) {
+      return false;
+    }
+  }
+  // initialize cwd as root directory
+  auto blk_ofs = AllocDataBlock();
+  auto inode_id = AllocINode(INodeType::Dir);
+  assert(blk_ofs && inode_id);
+  cwd_ = {INodeType::Dir, 0, 1, 2 * sizeof(Entry), 1};
+  cwd_.direct[0] = *blk_ofs;
+  cwd_id_ = *inode_id;
+  UpdateINode(cwd_, cwd_id_);
+  InitDirBlock(*blk_ofs, cwd_id_, cwd_id_);
+  // sync
+  return dev_.Sync();
+}
+
+template <typename Layout>
+bool GeeFSEngine<Layout>::Open(const SuperBlockHeader &super_block) {
+  super_block_ = super_block;
+  InitLocks();
+  read_ahead_.Invalidate();
+  // set root directory as cwd
+  if (!ReadINode(cwd_, 0)) return false;
+  cwd_id_ = 0;
+  return cwd_.type == INodeType::Dir;
+}
+
+template <typename Layout>
+void GeeFSEngine<Layout>::List(std::ostream &os) {
+  std::lock_guard<std::mutex> lock(GetDirLock(cwd_id_));
+  auto ret = WalkEntry([this, &os](const Entry &entry) {
+    // get inode info
+    INode inode;
+    if (!ReadINode(inode, entry.inode_id)) return false;
+    // print to stream
+    os << std::left;
+    os << std::setw(7) << kTypeStr[static_cast<int>(inode.type)] << ' ';
+    os << std::setw(kFileNameMaxLen + 1) << entry.filename << ' ';
+    PrintFileSize(os, inode.size);
+    os << std::endl;
+    return true;
+  });
+  static_cast<void>(ret);
+  assert(ret);
+}
+
+template <typename Layout>
+bool GeeFSEngine<Layout>::CreateFile(std::string_view file_name) {
+  std::lock_guard<std::mutex> lock(GetDirLock(cwd_id_));
+  // allocate new inode for file
+  auto inode_id = AllocINode(INodeType::File);
+  if (!inode_id) return false;
+  // create new entry
+  if (!AddEntry(*inode_id, file_name)) {
+    FreeINode(*inode_id);
+    return false;
+  }
+  return true;
+}
+
+template <typename Layout>
+bool GeeFSEngine<Layout>::MakeDir(std::string_view dir_name) {
+  std::lock_guard<std::mutex> lock(GetDirLock(cwd_id_));
+  // allocate new inode for directory
+  auto inode_id = AllocINode(INodeType::Dir);
+  if (!inode_id) return false;
+  // create new entry
+  if (!AddEntry(*inode_id, dir_name)) {
+    FreeINode(*inode_id);
+    return false;
+  }
+  // allocate data block for directory
+  auto blk_ofs = AllocDataBlock();
+  if (!blk_ofs) return false;
+  // update allocated inode
+  INode inode = {INodeType::Dir, 0, 1, 2 * sizeof(Entry), 1, {*blk_ofs}};
+  UpdateINode(inode, *inode_id);
+  // initialize data block
+  InitDirBlock(*blk_ofs, *inode_id, cwd_id_);
+  return true;
+}
+
+template <typename Layout>
+bool GeeFSEngine<Layout>::ChangeDir(std::string_view dir_name) {
+  // get inode by directory name
+  INode inode;
+  std::optional<std::uint32_t> id;
+  {
+    std::lock_guard<std::mutex> lock(GetDirLock(cwd_id_));
+    id = ReadINode(inode, dir_name);
+  }
+  if (!id || inode.type != INodeType::Dir) return false;
+  // change cwd
+  cwd_ = inode;
+  cwd_id_ = *id;
+  return true;
+}
+
+template <typename Layout>
+bool GeeFSEngine<Layout>::Remove(std::string_view file_name) {
+  // TODO
+  return false;
+}
+
+template <typename Layout>
+std::int32_t GeeFSEngine<Layout>::Read(std::string_view file_name,
+                                       std::ostream &os, std::size_t offset,
+                                       std::size_t len) {
+  // get inode
+  INode inode;
+  std::optional<std::uint32_t> id;
+  {
+    std::lock_guard<std::mutex> lock(GetDirLock(cwd_id_));
+    id = ReadINode(inode, file_name);
+  }
+  if (!id) return -1;
+  return ReadData(inode, *id, os, offset, len);
+}
+
+template <typename Layout>
+std::int32_t GeeFSEngine<Layout>::ReadINodeData(std::uint32_t inode_id,
+                                                std::ostream &os,
+                                                std::size_t offset,
+                                                std::size_t len) {
+  INode inode;
+  if (!ReadINode(inode, inode_id) || inode.type != INodeType::File) {
+    return -1;
+  }
+  return ReadData(inode, inode_id, os, offset, len);
+}
+
+template <typename Layout>
+std::optional<std::uint32_t> GeeFSEngine<Layout>::GetINodeId(
+    std::string_view file_name) {
+  std::lock_guard<std::mutex> lock(GetDirLock(cwd_id_));
+  Entry entry;
+  if (!FindEntry(file_name, entry)) return {};
+  return entry.inode_id;
+}
+
+template <typename Layout>
+bool GeeFSEngine<Layout>::Link(std::uint32_t inode_id,
+                               std::string_view file_name) {
+  // get inode, only files can be linked
+  INode inode;
+  if (!ReadINode(inode, inode_id) || inode.type != INodeType::File) {
+    return false;
+  }
+  // update link count, treat 0 as 1 for older images
+  auto link_count = std::max<std::uint16_t>(inode.link_count, 1);
+  if (link_count == std::numeric_limits<std::uint16_t>::max()) return false;
+  // create new entry
+  {
+    std::lock_guard<std::mutex> lock(GetDirLock(cwd_id_));
+    if (!AddEntry(inode_id, file_name)) return false;
+  }
+  inode.link_count = link_count + 1;
+  UpdateINode(inode, inode_id);
+  return EnableFeature(kFeatureHardLink);
+}
+
+template <typename Layout>
+bool GeeFSEngine<Layout>::AddPreloadEntry(const PreloadEntry &entry) {
+  std::lock_guard<std::mutex> lock(super_block_lock_);
+  PreloadHeader hdr = {0};
+  if (!super_block_.manifest) {
+    // allocate & initialize manifest block
+    auto blk_ofs = AllocDataBlock();
+    if (!blk_ofs) return false;
+    super_block_.manifest = *blk_ofs;
+    super_block_.features |= kFeaturePreload;
+    // header of older images does not contain 'manifest'
+    super_block_.header_size = sizeof(SuperBlockHeader);
+    if (!dev_.WriteAssert(sizeof(hdr), hdr, BlockToOffset(*blk_ofs)) ||
+        !dev_.WriteAssert(sizeof(super_block_), super_block_, 0)) {
+      return false;
+    }
+  }
+  else {
+    auto offset = BlockToOffset(super_block_.manifest);
+    if (!dev_.ReadAssert(sizeof(hdr), hdr, offset)) return false;
+  }
+  // check if manifest is full
+  auto ofs = sizeof(hdr) + hdr.entry_num * sizeof(entry);
+  if (ofs + sizeof(entry) > block_size()) return false;
+  // write entry & update header
+  auto offset = BlockToOffset(super_block_.manifest);
+  ++hdr.entry_num;
+  return dev_.WriteAssert(sizeof(entry), entry, offset + ofs) &&
+         dev_.WriteAssert(sizeof(hdr), hdr, offset);
+}
+
+template <typename Layout>
+std::int32_t GeeFSEngine<Layout>::ReadData(const INode &inode,
+                                           std::uint32_t id,
+                                           std::ostream &os,
+                                           std::size_t offset,
+                                           std::size_t len) {
+  if (offset >= inode.size) return 0;
+  // read inline data
+  if (inode.flags & kINodeFlagInline) {
+    auto count = std::min<std::size_t>(len, inode.size - offset);
+    os.write(reinterpret_cast<const char *>(GetInlineData(inode) + offset),
+             count);
+    return count;
+  }
+  auto end = offset + std::min<std::size_t>(len, inode.size - offset);
+  if (async_dev_) return ReadAsync(inode, os, offset, end);
+  // read file block by block
+  auto buf = layout_.NewBuffer();
+  std::int32_t data_len = 0;
+  for (auto i = offset; i < end;) {
+    // get block offset
+    auto n = i / block_size();
+    auto blk_ofs = GetBlockOffset(inode, n);
+    if (!blk_ofs) break;
+    // get offset & length in current block
+    auto inblk_ofs = i % block_size();
+    auto count = std::min<std::size_t>(block_size() - inblk_ofs, end - i);
+    // read to stream, holes are read as zeros
+    if (!*blk_ofs) {
+      std::memset(buf.data(), 0, count);
+    }
+    else if (!read_ahead_.Read(*blk_ofs, inblk_ofs, buf.data(), count)) {
+      break;
+    }
+    // prefetch the following blocks if reading sequentially
+    auto [first, last] = read_ahead_.Access(id, n, inode.block_num);
+    if (first < last) PrefetchBlocks(inode, first, last);
+    os.write(reinterpret_cast<const char *>(buf.data()), count);
+    i += count;
+    data_len += count;
+  }
+  return data_len;
+}
+
+template <typename Layout>
+void GeeFSEngine<Layout>::PrefetchBlocks(const INode &inode,
+                                         std::size_t first,
+                                         std::size_t last) {
+  // resolve block offsets first, which also reads pointer blocks ahead
+  std::vector<std::uint32_t> blks;
+  for (auto n = first; n < last; ++n) {
+    auto blk_ofs = GetBlockOffset(inode, n);
+    if (!blk_ofs) break;
+    if (*blk_ofs) blks.push_back(*blk_ofs);
+  }
+  read_ahead_.Prefetch(blks);
+}
+
+template <typename Layout>
+std::int32_t GeeFSEngine<Layout>::ReadAsync(const INode &inode,
+                                            std::ostream &os,
+                                            std::size_t offset,
+                                            std::size_t end) {
+  std::int32_t data_len = 0;
+  std::vector<std::size_t> lens(async_dev_->queue_depth());
+  std::size_t pending = 0;
+  // wait for queued requests and write buffers to stream in order
+  auto flush = [this, &os, &lens, &pending, &data_len] {
+    if (!async_dev_->Wait()) return false;
+    for (std::size_t i = 0; i < pending; ++i) {
+      os.write(reinterpret_cast<const char *>(async_dev_->buffer(i)),
+               lens[i]);
+      data_len += lens[i];
+    }
+    pending = 0;
+    return true;
+  };
+  for (auto i = offset; i < end;) {
+    // get block offset
+    auto blk_ofs = GetBlockOffset(inode, i / block_size());
+    if (!blk_ofs) break;
+    // get offset & length in current block
+    auto inblk_ofs = i % block_size();
+    auto count = std::min<std::size_t>(block_size() - inblk_ofs, end - i);
+    auto ofs = BlockToOffset(*blk_ofs) + inblk_ofs;
+    // queue the request, flush when all buffers are in use
+    // holes are filled with zeros without reading
+    if (!*blk_ofs) {
+      std::memset(async_dev_->buffer(pending), 0, count);
+    }
+    else if (!async_dev_->SubmitRead(pending, count, ofs)) {
+      break;
+    }
+    lens[pending] = count;
+    if (++pending == lens.size() && !flush()) return data_len;
+    i += count;
+  }
+  flush();
+  return data_len;
+}
+
+template <typename Layout>
+std::int32_t GeeFSEngine<Layout>::Write(std::string_view file_name,
+                                        std::istream &is,
+                                        std::size_t offset,
+                                        std::size_t len) {
+  // get inode
+  INode inode;
+  std::optional<std::uint32_t> id;
+  {
+    std::lock_guard<std::mutex> lock(GetDirLock(cwd_id_));
+    id = ReadINode(inode, file_name);
+  }
+  if (!id) return -1;
+  return WriteData(inode, *id, is, offset, len);
+}
+
+template <typename Layout>
+std::int32_t GeeFSEngine<Layout>::WriteINodeData(std::uint32_t inode_id,
+                                                 std::istream &is,
+                                                 std::size_t offset,
+                                                 std::size_t len) {
+  TraceSpan span("WriteINodeData");
+  span.AddArg("inode", inode_id);
+  span.AddArg("len", len);
+  INode inode;
+  if (!ReadINode(inode, inode_id) || inode.type != INodeType::File) {
+    return -1;
+  }
+  return WriteData(inode, inode_id, is, offset, len);
+}
+
+template <typename Layout>
+std::int32_t GeeFSEngine<Layout>::WriteINodeExtent(std::uint32_t inode_id,
+                                                   std::istream &is,
+                                                   std::size_t len,
+                                                   std::uint32_t &first_blk) {
+  TraceSpan span("WriteINodeExtent");
+  span.AddArg("inode", inode_id);
+  span.AddArg("len", len);
+  first_blk = 0;
+  INode inode;
+  if (!ReadINode(inode, inode_id) || inode.type != INodeType::File) {
+    return -1;
+  }
+  // fall back to normal writes if file is not empty or can be inlined
+  auto blk_num = (len + block_size() - 1) / block_size();
+  std::optional<std::uint32_t> first;
+  if (!inode.size && !inode.block_num &&
+      !(inline_data_ && len <= kInlineDataSize)) {
+    first = AllocExtent(blk_num);
+  }
+  if (!first) return WriteData(inode, inode_id, is, 0, len);
+  // write data with large sequential requests
+  read_ahead_.Invalidate();
+  std::vector<std::uint8_t> buf(std::min(len, kExtentBufferSize));
+  std::size_t data_len = 0;
+  while (data_len < len) {
+    auto count = std::min(buf.size(), len - data_len);
+    is.read(reinterpret_cast<char *>(buf.data()), count);
+    count = is.gcount();
+    if (!count) break;
+    auto offset = BlockToOffset(*first) + data_len;
+    if (!dev_.WriteAssert(count, buf.data(), count, offset)) return -1;
+    data_len += count;
+  }
+  // add written blocks to inode, free (and clear) the rest if stream is
+  // too short
+  auto used_num = (data_len + block_size() - 1) / block_size();
+  for (std::size_t i = 0; i < blk_num; ++i) {
+    if (i < used_num ? !AppendBlock(inode, *first + i)
+                     : !FreeDataBlock(*first + i)) {
+      return -1;
+    }
+  }
+  // update inode, only complete files can be listed in preload manifest
+  inode.size = data_len;
+  UpdateINode(inode, inode_id);
+  if (data_len == len) first_blk = *first;
+  return data_len;
+}
+
+template <typename Layout>
+std::int32_t GeeFSEngine<Layout>::WriteData(INode &inode, std::uint32_t id,
+                                            std::istream &is,
+                                            std::size_t offset,
+                                            std::size_t len) {
+  read_ahead_.Invalidate();
+  // write inline data if file is small enough
+  // empty writes do not convert files, which keeps empty files readable by
+  // kernels without inline data support
+  if (offset + len <= kInlineDataSize &&
+      ((inode.flags & kINodeFlagInline) ||
+       (inline_data_ && len && !inode.block_num && !inode.size))) {
+    auto data = GetInlineData(inode);
+    if (offset > inode.size) {
+      std::memset(data + inode.size, 0, offset - inode.size);
+    }
+    is.read(reinterpret_cast<char *>(data + offset), len);
+    std::int32_t data_len = is.gcount();
+    if (offset + data_len > inode.size) inode.size = offset + data_len;
+    inode.flags |= kINodeFlagInline;
+    UpdateINode(inode, id);
+    return EnableFeature(kFeatureInlineData) ? data_len : -1;
+  }
+  // file is too large, move inline data out
+  if ((inode.flags & kINodeFlagInline) && !MoveInlineData(inode)) return -1;
+  auto buf = layout_.NewBuffer();
+  bool has_hole = false;
+  // expand file size if necessary
+  if (offset > inode.size) {
+    // add empty data blocks (or holes) before the block containing offset
+    for (auto i = inode.block_num; i < offset / block_size(); ++i) {
+      if (sparse_) {
+        if (!AppendBlock(inode, 0)) return -1;
+        has_hole = true;
+        continue;
+      }
+      auto blk_ofs = AllocDataBlock();
+      if (!blk_ofs || !AppendBlock(inode, *blk_ofs) ||
+          !dev_.WriteAssert(buf.size(), buf.data(), buf.size(),
+                            BlockToOffset(*blk_ofs))) {
+        return -1;
+      }
+    }
+    // update file size
+    inode.size = offset;
+  }
+  // write to file block by block
+  std::int32_t data_len = 0;
+  std::size_t pending = 0;
+  for (auto i = offset; i < offset + len;) {
+    // read from stream
+    auto n = i / block_size();
+    auto inblk_ofs = i % block_size();
+    auto count = std::min<std::size_t>(block_size() - inblk_ofs,
+                                       offset + len - i);
+    auto data = async_dev_ ? async_dev_->buffer(pending) : buf.data();
+    is.read(reinterpret_cast<char *>(data), count);
+    count = is.gcount();
+    if (!count) break;
+    // get block offset
+    std::optional<std::uint32_t> blk_ofs;
+    if (n < inode.block_num) {
+      blk_ofs = GetBlockOffset(inode, n);
+      if (!blk_ofs) return -1;
+    }
+    if ((!blk_ofs || !*blk_ofs) && sparse_ && IsZeroData(data, count)) {
+      // leave all-zero block as a hole
+      if (!blk_ofs && !AppendBlock(inode, 0)) return -1;
+      has_hole = true;
+      i += count;
+      data_len += count;
+      continue;
+    }
+    if (!blk_ofs || !*blk_ofs) {
+      if (blk_ofs) {
+        // fill the hole with a new data block
+        blk_ofs = AllocDataBlock();
+        if (!blk_ofs) break;
+        auto empty_blk = layout_.NewBuffer();
+        if ((count < block_size() &&
+             !dev_.WriteAssert(empty_blk.size(), empty_blk.data(),
+                               empty_blk.size(), BlockToOffset(*blk_ofs))) ||
+            !SetBlockOffset(inode, n, *blk_ofs)) {
+          return -1;
+        }
+      }
+      else {
+        // allocate a new data block
+        blk_ofs = AllocDataBlock();
+        if (!blk_ofs) break;
+        if (!AppendBlock(inode, *blk_ofs)) return -1;
+      }
+    }
+    // write to block
+    if (async_dev_) {
+      // queue the request, wait when all buffers are in use
+      auto ofs = BlockToOffset(*blk_ofs) + inblk_ofs;
+      if (!async_dev_->SubmitWrite(pending, count, ofs)) break;
+      if (++pending == async_dev_->queue_depth()) {
+        if (!async_dev_->Wait()) return -1;
+        pending = 0;
+      }
+    }
+    else {
+      auto ofs = BlockToOffset(*blk_ofs) + inblk_ofs;
+      if (!dev_.WriteAssert(count, buf.data(), count, ofs)) break;
+    }
+    i += count;
+    data_len += count;
+  }
+  if (async_dev_ && !async_dev_->Wait()) return -1;
+  // update inode
+  if (offset + data_len > inode.size) inode.size = offset + data_len;
+  UpdateINode(inode, id);
+  if (has_hole && !EnableFeature(kFeatureSparse)) return -1;
+  return data_len;
+}
+
+// instantiations of all supported block layouts
+template class GeeFSEngine<FixedLayout<256>>;
+template class GeeFSEngine<FixedLayout<512>>;
+template class GeeFSEngine<FixedLayout<1024>>;
+template class GeeFSEngine<FixedLayout<2048>>;
+template class GeeFSEngine<FixedLayout<4096>>;
+template class GeeFSEngine<DynamicLayout>;
+
+std::unique_ptr<GeeFSEngineBase> NewGeeFSEngine(Device &dev,
+                                                std::uint32_t block_size) {
+  switch (block_size) {
+    case 256: {
+      return std::make_unique<GeeFSEngine<FixedLayout<256>>>(dev,
+                                                             block_size);
+    }
+    case 512: {
+      return std::make_unique<GeeFSEngine<FixedLayout<512>>>(dev,
+                                                             block_size);
+    }
+    case 1024: {
+      return std::make_unique<GeeFSEngine<FixedLayout<1024>>>(dev,
+                                                              block_size);
+    }
+    case 2048: {
+      return std::make_unique<GeeFSEngine<FixedLayout<2048>>>(dev,
+                                                              block_size);
+    }
+    case 4096: {
+      return std::make_unique<GeeFSEngine<FixedLayout<4096>>>(dev,
+                                                              block_size);
+    }
+    default: {
+      return std::make_unique<GeeFSEngine<DynamicLayout>>(dev, block_size);
+    }
+  }
+}
@@ -0,0 +1,286 @@
+#ifndef GEEOS_MKFS_ENGINE_H_
+#define GEEOS_MKFS_ENGINE_H_
+
+#include <istream>
+#include <ostream>
+#include <string_view>
+#include <optional>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <cstddef>
+#include <cstdint>
+
+#include "device.h"
+#include "structs.h"
+#include "readahead.h"
+
+// interface of GeeFS engines
+// file data can be read and written by multiple threads concurrently,
+// as long as threads access different files, operations on cwd are
+// serialized by directory locks, and cwd should only be changed by one
+// thread
+class GeeFSEngineBase {
+ public:
+  virtual ~GeeFSEngineBase() = default;
+
+  // create an empty GeeFS image on device
+  virtual bool Create(std::uint32_t free_map_num,
+                      std::uint32_t inode_blk_num) = 0;
+  // open GeeFS image on device by super block header
+  virtual bool Open(const SuperBlockHeader &super_block) = 0;
+
+  // list all files/dirs in cwd
+  virtual void List(std::ostream &os) = 0;
+  // create new file in cwd
+  virtual bool CreateFile(std::string_view file_name) = 0;
+  // create new directory in cwd
+  virtual bool MakeDir(std::string_view dir_name) = 0;
+  // change cwd
+  virtual bool ChangeDir(std::string_view dir_name) = 0;
+  // remove file in cwd
+  virtual bool Remove(std::string_view file_name) = 0;
+  // read file in cwd to output stream
+  virtual std::int32_t Read(std::string_view file_name, std::ostream &os,
+                            std::size_t offset, std::size_t len) = 0;
+  // write input stream to file in cwd
+  virtual std::int32_t Write(std::string_view file_name, std::istream &is,
+                             std::size_t offset, std::size_t len) = 0;
+  // write input stream to file by inode id
+  virtual std::int32_t WriteINodeData(std::uint32_t inode_id,
+                                      std::istream &is, std::size_t offset,
+                                      std::size_t len) = 0;
+  // write input stream to an empty file by inode id, allocating data
+  // blocks contiguously if possible, 'first_blk' is set to the first
+  // data block, or 0 if blocks are not contiguous
+  virtual std::int32_t WriteINodeExtent(std::uint32_t inode_id,
+                                        std::istream &is, std::size_t len,
+                                        std::uint32_t &first_blk) = 0;
+  // read file by inode id to output stream
+  virtual std::int32_t ReadINodeData(std::uint32_t inode_id,
+                                     std::ostream &os, std::size_t offset,
+                                     std::size_t len) = 0;
+  // get inode id of file in cwd
+  virtual std::optional<std::uint32_t> GetINodeId(
+      std::string_view file_name) = 0;
+  // create a hard link to file in cwd
+  virtual bool Link(std::uint32_t inode_id, std::string_view file_name) = 0;
+  // append an entry to preload manifest, returns false if failed or
+  // manifest is full
+  virtual bool AddPreloadEntry(const PreloadEntry &entry) = 0;
+
+  // set the entry number that directories will be converted to
+  // indexed form when exceeding it, 0 means never converting
+  void set_index_threshold(std::uint32_t index_threshold) {
+    index_threshold_ = index_threshold;
+  }
+  // set if small files should be stored inside their inodes
+  void set_inline_data(bool inline_data) { inline_data_ = inline_data; }
+  // set if all-zero blocks should be left as holes
+  void set_sparse(bool sparse) { sparse_ = sparse; }
+  // set memory budget of read-ahead in bytes, 0 means disabling it
+  virtual void set_read_ahead_budget(std::size_t budget) = 0;
+  // get counters of read-ahead
+  virtual ReadAheadStats read_ahead_stats() const = 0;
+
+ protected:
+  // threshold of indexed directories
+  std::uint32_t index_threshold_ = 0;
+  // enable inline data
+  bool inline_data_ = false;
+  // enable sparse files
+  bool sparse_ = false;
+};
+
+// GeeFS engine, specialized by block layout
+template <typename Layout>
+class GeeFSEngine : public GeeFSEngineBase {
+ public:
+  GeeFSEngine(Device &dev, std::uint32_t block_size)
+      : dev_(dev), layout_(block_size), read_ahead_(dev, block_size) {
+    // use asynchronous I/O if buffers of device can hold a block
+    async_dev_ = dynamic_cast<AsyncDevice *>(&dev);
+    if (async_dev_ && async_dev_->buffer_size() < block_size) {
+      async_dev_ = nullptr;
+    }
+  }
+
+  bool Create(std::uint32_t free_map_num,
+              std::uint32_t inode_blk_num) override;
+  bool Open(const SuperBlockHeader &super_block) override;
+
+  void List(std::ostream &os) override;
+  bool CreateFile(std::string_view file_name) override;
+  bool MakeDir(std::string_view dir_name) override;
+  bool ChangeDir(std::string_view dir_name) override;
+  bool Remove(std::string_view file_name) override;
+  std::int32_t Read(std::string_view file_name, std::ostream &os,
+                    std::size_t offset, std::size_t len) override;
+  std::int32_t Write(std::string_view file_name, std::istream &is,
+                     std::size_t offset, std::size_t len) override;
+  std::int32_t WriteINodeData(std::uint32_t inode_id, std::istream &is,
+                              std::size_t offset, std::size_t len) override;
+  std::int32_t WriteINodeExtent(std::uint32_t inode_id, std::istream &is,
+                                std::size_t len,
+                                std::uint32_t &first_blk) override;
+  std::int32_t ReadINodeData(std::uint32_t inode_id, std::ostream &os,
+                             std::size_t offset, std::size_t len) override;
+  std::optional<std::uint32_t> GetINodeId(
+      std::string_view file_name) override;
+  bool Link(std::uint32_t inode_id, std::string_view file_name) override;
+  bool AddPreloadEntry(const PreloadEntry &entry) override;
+
+  void set_read_ahead_budget(std::size_t budget) override {
+    read_ahead_.set_budget(budget);
+  }
+  ReadAheadStats read_ahead_stats() const override {
+    return read_ahead_.stats();
+  }
+
+ private:
+  // allocation group, which consists of a free map block and data blocks
+  // managed by it
+  struct AllocGroup {
+    // lock of free map block
+    std::mutex lock;
+    // byte offset in free map block, bytes before it are all allocated
+    std::size_t hint;
+  };
+
+  // size of block
+  auto block_size() const { return layout_.block_size(); }
+  // number of block offsets in an indirect block
+  auto ofs_per_blk() const { return block_size() / kBlockOfsSize; }
+  // number of inodes in an inode block
+  auto in_per_blk() const {
+    return (block_size() - sizeof(INodeBlockHeader)) / sizeof(INode);
+  }
+  // number of entries in a data block of directory
+  auto ent_per_blk() const { return block_size() / sizeof(Entry); }
+  // max number of buckets in index block of indexed directory
+  auto max_bucket_num() const {
+    return (block_size() - sizeof(IndexBlockHeader)) / kBlockOfsSize;
+  }
+  // number of entries in a bucket block of indexed directory
+  auto ent_per_bucket_blk() const { return ent_per_blk() - 1; }
+  // number of data blocks managed by a free map block
+  auto blk_per_fmb() const {
+    return (block_size() - sizeof(FreeMapBlockHeader)) * 8;
+  }
+  // get byte offset of block on device
+  std::size_t BlockToOffset(std::size_t blk_ofs) const {
+    return blk_ofs * block_size();
+  }
+
+  // initialize locks of allocation groups and inode blocks
+  void InitLocks();
+  // get lock of directory by inode id
+  std::mutex &GetDirLock(std::uint32_t id);
+  // allocate a data block, returns block offset
+  std::optional<std::uint32_t> AllocDataBlock();
+  // allocate contiguous data blocks in the same allocation group,
+  // returns the first block
+  std::optional<std::uint32_t> AllocExtent(std::size_t n);
+  // free an allocated data block
+  bool FreeDataBlock(std::uint32_t blk_ofs);
+  // free all data blocks and indirect blocks of inode
+  bool FreeBlocks(INode &inode);
+  // allocate an inode with the specific type, returns inode id
+  std::optional<std::uint32_t> AllocINode(INodeType type);
+  // free an allocated inode
+  void FreeINode(std::uint32_t id);
+  // initialize data block of directory
+  void InitDirBlock(std::uint32_t blk_ofs, std::uint32_t cur_id,
+                    std::uint32_t parent_id);
+  // get byte offset of inode on device
+  std::size_t GetINodeOffset(std::uint32_t id) const;
+  // update inode by id
+  void UpdateINode(const INode &inode, std::uint32_t id);
+  // read inode by id
+  bool ReadINode(INode &inode, std::uint32_t id);
+  // read inode by file name, returns inode id
+  std::optional<std::uint32_t> ReadINode(INode &inode,
+                                         std::string_view name);
+  // get nth data block offset of inode
+  std::optional<std::uint32_t> GetBlockOffset(const INode &inode,
+                                              std::size_t n);
+  // append block to inode
+  bool AppendBlock(INode &inode, std::uint32_t blk_ofs);
+  // replace the offset of the n-th data block of inode
+  bool SetBlockOffset(INode &inode, std::size_t n, std::uint32_t blk_ofs);
+  // write input stream to inode
+  std::int32_t WriteData(INode &inode, std::uint32_t id, std::istream &is,
+                         std::size_t offset, std::size_t len);
+  // read data of inode to output stream
+  std::int32_t ReadData(const INode &inode, std::uint32_t id,
+                        std::ostream &os, std::size_t offset,
+                        std::size_t len);
+  // prefetch data blocks in range [first, last) of inode
+  void PrefetchBlocks(const INode &inode, std::size_t first,
+                      std::size_t last);
+  // read data in range [offset, end) of inode using asynchronous I/O
+  std::int32_t ReadAsync(const INode &inode, std::ostream &os,
+                         std::size_t offset, std::size_t end);
+  // get inline data of inode
+  static std::uint8_t *GetInlineData(INode &inode) {
+    return reinterpret_cast<std::uint8_t *>(inode.direct);
+  }
+  static const std::uint8_t *GetInlineData(const INode &inode) {
+    return reinterpret_cast<const std::uint8_t *>(inode.direct);
+  }
+  // move inline data of inode to a data block
+  bool MoveInlineData(INode &inode);
+  // enable feature in super block
+  bool EnableFeature(std::uint32_t feature);
+  // traverse all entries of cwd
+  bool WalkEntry(std::function<bool(const Entry &)> callback);
+  // find entry in cwd by file name
+  bool FindEntry(std::string_view name, Entry &entry);
+  // add new entry in cwd
+  bool AddEntry(std::uint32_t inode_id, std::string_view file_name);
+  // get number of buckets for indexed directory with the specific
+  // number of entries
+  std::size_t GetBucketNum(std::size_t entry_num) const;
+  // get byte offset of bucket of file name in index block of indexed cwd
+  std::optional<std::size_t> GetBucketOffset(std::string_view name);
+  // check if buckets of indexed cwd are too long
+  bool NeedMoreBuckets();
+  // add new entry to bucket of indexed cwd
+  bool AddIndexedEntry(const Entry &entry);
+  // convert cwd to indexed directory, or rebuild index of indexed cwd
+  bool ConvertToIndexed();
+
+  // low-level device
+  Device &dev_;
+  // asynchronous interface of device, 'nullptr' if not supported
+  AsyncDevice *async_dev_;
+  // block layout
+  Layout layout_;
+  // read-ahead engine of file data
+  ReadAhead read_ahead_;
+  // super block of disk
+  SuperBlockHeader super_block_;
+  // current working directory
+  INode cwd_;
+  // inode id of cwd
+  std::uint32_t cwd_id_;
+  // allocation groups
+  std::unique_ptr<AllocGroup[]> groups_;
+  // locks of inode blocks
+  std::unique_ptr<std::mutex[]> inode_blk_locks_;
+  // index of inode block to start searching free inodes from
+  std::atomic<std::uint32_t> inode_hint_;
+  // lock of super block
+  std::mutex super_block_lock_;
+  // locks of directories, and the lock that protects them
+  std::mutex dir_locks_lock_;
+  std::unordered_map<std::uint32_t, std::unique_ptr<std::mutex>> dir_locks_;
+};
+
+// create a new GeeFS engine specialized for the specific block size
+std::unique_ptr<GeeFSEngineBase> NewGeeFSEngine(Device &dev,
+                                                std::uint32_t block_size);
+
+#endif  // GEEOS_MKFS_ENGINE_H_
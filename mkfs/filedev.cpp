@@ -0,0 +1,47 @@
+#include "filedev.h"
+
+#include <algorithm>
+#include <string>
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+FileDevice::~FileDevice() {
+  if (fd_ >= 0) close(fd_);
+}
+
+bool FileDevice::Open(std::string_view file_name) {
+  fd_ = open(std::string(file_name).c_str(), O_RDWR | O_CREAT, 0644);
+  struct stat st;
+  if (fd_ < 0 || fstat(fd_, &st) < 0) return false;
+  size_ = st.st_size;
+  return true;
+}
+
+std::int32_t FileDevice::Read(std::uint8_t *buf, std::size_t len,
+                              std::size_t offset) {
+  if (offset >= size_) return -1;
+  auto size = std::min(size_ - offset, len);
+  auto ret = pread(fd_, buf, size, offset);
+  return static_cast<std::size_t>(ret) == size ? size : -1;
+}
+
+std::int32_t FileDevice::Write(const std::uint8_t *buf, std::size_t len,
+                               std::size_t offset) {
+  if (offset >= size_) return -1;
+  auto size = std::min(size_ - offset, len);
+  auto ret = pwrite(fd_, buf, size, offset);
+  return static_cast<std::size_t>(ret) == size ? size : -1;
+}
+
+bool FileDevice::Sync() {
+  // like 'IOStreamDevice', only makes sure all writes are issued
+  return fd_ >= 0;
+}
+
+bool FileDevice::Resize(std::size_t size) {
+  if (ftruncate(fd_, size) < 0) return false;
+  size_ = size;
+  return true;
+}
@@ -0,0 +1,37 @@
+#ifndef GEEOS_MKFS_FILEDEV_H_
+#define GEEOS_MKFS_FILEDEV_H_
+
+#include <string_view>
+#include <cstddef>
+#include <cstdint>
+
+#include "device.h"
+
+// device backed by a file, using positional I/O
+// unlike 'IOStreamDevice', reads and writes do not share a file position,
+// so threads can access the device concurrently without locking
+class FileDevice : public DeviceBase {
+ public:
+  FileDevice() : fd_(-1), size_(0) {}
+  FileDevice(const FileDevice &) = delete;
+  ~FileDevice();
+
+  // open (or create) file, returns false on failure
+  bool Open(std::string_view file_name);
+
+  std::int32_t Read(std::uint8_t *buf, std::size_t len,
+                    std::size_t offset) override;
+  std::int32_t Write(const std::uint8_t *buf, std::size_t len,
+                     std::size_t offset) override;
+  bool Sync() override;
+  bool Resize(std::size_t size) override;
+
+  // size of file
+  std::size_t size() const { return size_; }
+
+ private:
+  int fd_;
+  std::size_t size_;
+};
+
+#endif  // GEEOS_MKFS_FILEDEV_H_
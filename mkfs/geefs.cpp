@@ -1,435 +1,189 @@
 #include "geefs.h"
 
+#include <sstream>
+#include <memory>
 #include <vector>
 #include <algorithm>
-#include <string>
-#include <iomanip>
 #include <cstring>
-#include <cassert>
+
+#include "trace.h"
+#include "elf.h"
 
 namespace {
 
-const char *kTypeStr[] = {"unused", "file", "dir"};
+// files larger than this are streamed through a fixed-size buffer
+// instead of being read into memory
+constexpr std::size_t kMaxBufferedSize = 1024 * 1024;
+// size of buffer for streaming large files
+constexpr std::size_t kStreamBufferSize = 64 * 1024;
 
-void PrintFileSize(std::ostream &os, std::size_t size) {
-  if (size < 1024) {
-    os << size << 'B';
-  }
-  else {
-    os << std::fixed << std::setprecision(1);
-    if (size < 1024 * 1024) {
-      os << size / 1024.0 << 'K';
+// fast non-cryptographic hash of file content, can be fed in chunks
+// processes 8 bytes per round, collisions are resolved by byte compare
+class ContentHasher {
+ public:
+  explicit ContentHasher(std::size_t size)
+      : hash_(size * kPrime1), tail_len_(0) {}
+
+  // hash the next chunk of content
+  void Update(std::string_view data) {
+    // complete the word left by the previous chunk
+    while (tail_len_ && tail_len_ < sizeof(tail_) && !data.empty()) {
+      tail_[tail_len_++] = data.front();
+      data.remove_prefix(1);
     }
-    else if (size < 1024 * 1024 * 1024) {
-      os << size / 1024.0 / 1024.0 << 'M';
+    if (tail_len_ == sizeof(tail_)) {
+      UpdateWord(tail_);
+      tail_len_ = 0;
     }
-    else {
-      os << size / 1024.0 / 1024.0 / 1024.0 << 'G';
+    for (; data.size() >= sizeof(tail_); data.remove_prefix(sizeof(tail_))) {
+      UpdateWord(data.data());
     }
+    std::memcpy(tail_, data.data(), data.size());
+    tail_len_ += data.size();
   }
-}
 
-}  // namespace
-
-std::optional<std::uint32_t> GeeFS::AllocDataBlock() {
-  // traverse all free maps
-  for (int i = 0; i < super_block_.free_map_num; ++i) {
-    // read free map header
-    auto offset = super_block_.block_size * (1 + i);
-    FreeMapBlockHeader hdr;
-    auto ret = dev_.ReadAssert(sizeof(hdr), hdr, offset);
-    assert(ret);
-    // check for free blocks
-    if (hdr.unused_num) {
-      // update header
-      --hdr.unused_num;
-      ret = dev_.WriteAssert(sizeof(hdr), hdr, offset);
-      assert(ret);
-      // read free map to buffer
-      std::vector<std::uint8_t> buf;
-      buf.resize(super_block_.block_size - sizeof(hdr));
-      ret = dev_.ReadAssert(buf.size(), buf, offset + sizeof(hdr));
-      assert(ret);
-      // find next free bit
-      for (int j = 0; j < buf.size(); ++j) {
-        for (int k = 7; k >= 0; --k) {
-          if (!(buf[j] & (1 << k))) {
-            // set free bit as allocated
-            buf[j] |= (1 << k);
-            // update free map
-            auto byte_ofs = offset + sizeof(hdr) + j;
-            auto ret = dev_.WriteAssert(1, buf[j], byte_ofs);
-            static_cast<void>(ret);
-            assert(ret);
-            // return block offset
-            auto blk_ofs = 1 + super_block_.free_map_num;
-            blk_ofs += super_block_.inode_blk_num;
-            blk_ofs += i * (super_block_.block_size - sizeof(hdr)) * 8;
-            blk_ofs += j * 8 + (7 - k);
-            return blk_ofs;
-          }
-        }
-      }
-      assert(false);
+  // get hash of all content
+  std::uint64_t Digest() const {
+    auto hash = hash_;
+    for (std::size_t i = 0; i < tail_len_; ++i) {
+      auto byte = static_cast<std::uint8_t>(tail_[i]);
+      hash = Rotl(hash ^ (byte * kPrime1), 11) * kPrime2;
     }
+    // final avalanche
+    hash ^= hash >> 33;
+    hash *= kPrime2;
+    hash ^= hash >> 29;
+    hash *= kPrime1;
+    return hash ^ (hash >> 32);
   }
-  return {};
-}
 
-std::optional<std::uint32_t> GeeFS::AllocINode() {
-  // traverse all inode blocks
-  for (int i = 0; i < super_block_.inode_blk_num; ++i) {
-    // read inode block header
-    auto offset = super_block_.block_size *
-                  (1 + super_block_.free_map_num + i);
-    INodeBlockHeader hdr;
-    auto ret = dev_.ReadAssert(sizeof(hdr), hdr, offset);
-    static_cast<void>(ret);
-    assert(ret);
-    // check for free inodes
-    if (hdr.unused_num) {
-      // update header
-      --hdr.unused_num;
-      auto ret = dev_.WriteAssert(sizeof(hdr), hdr, offset);
-      assert(ret);
-      // read inodes to buffer
-      std::vector<std::uint8_t> buf;
-      buf.resize(super_block_.block_size - sizeof(hdr));
-      ret = dev_.ReadAssert(buf.size(), buf, offset + sizeof(hdr));
-      assert(ret);
-      // find next free inode
-      for (int j = 0; j < buf.size(); j += sizeof(INode)) {
-        auto inode = reinterpret_cast<INode *>(buf.data() + j);
-        if (inode->type == INodeType::Unused) {
-          // return inode id
-          return i * ((super_block_.block_size - sizeof(hdr)) /
-                      sizeof(INode)) + (j / sizeof(INode));
-        }
-      }
-      assert(false);
-    }
-  }
-  return {};
-}
-
-void GeeFS::InitDirBlock(std::uint32_t blk_ofs, std::uint32_t cur_id,
-                         std::uint32_t parent_id) {
-  Entry ent;
-  auto offset = blk_ofs * super_block_.block_size;
-  // write entry '.'
-  ent.inode_id = cur_id;
-  std::strcpy(reinterpret_cast<char *>(ent.filename), ".");
-  auto ret = dev_.WriteAssert(sizeof(ent), ent, offset);
-  assert(ret);
-  // write entry '..'
-  ent.inode_id = parent_id;
-  std::strcpy(reinterpret_cast<char *>(ent.filename), "..");
-  ret = dev_.WriteAssert(sizeof(ent), ent, offset + sizeof(ent));
-  assert(ret);
-}
-
-void GeeFS::UpdateINode(const INode &inode, std::uint32_t id) {
-  auto in_per_blk = (super_block_.block_size - sizeof(INodeBlockHeader)) /
-                    sizeof(INode);
-  auto offset = 1 + super_block_.free_map_num + id / in_per_blk;
-  offset *= super_block_.block_size;
-  offset += sizeof(INodeBlockHeader) + (id % in_per_blk) * sizeof(INode);
-  auto ret = dev_.WriteAssert(sizeof(INode), inode, offset);
-  static_cast<void>(ret);
-  assert(ret);
-}
-
-bool GeeFS::ReadINode(INode &inode, std::uint32_t id) {
-  auto in_per_blk = (super_block_.block_size - sizeof(INodeBlockHeader)) /
-                    sizeof(INode);
-  auto offset = 1 + super_block_.free_map_num + id / in_per_blk;
-  offset *= super_block_.block_size;
-  offset += sizeof(INodeBlockHeader) + (id % in_per_blk) * sizeof(INode);
-  return dev_.ReadAssert(sizeof(INode), inode, offset);
-}
-
-std::optional<std::uint32_t> GeeFS::ReadINode(INode &inode,
-                                              std::string_view name) {
-  if (name.size() > kFileNameMaxLen - 1) return {};
-  std::optional<std::uint32_t> id = {};
-  WalkEntry([this, &inode, &name, &id](const Entry &entry) {
-    if (name == reinterpret_cast<const char *>(entry.filename)) {
-      if (ReadINode(inode, entry.inode_id)) id = entry.inode_id;
-      return false;
-    }
-    return true;
-  });
-  return id;
-}
+ private:
+  static constexpr std::uint64_t kPrime1 = 0x9e3779b185ebca87;
+  static constexpr std::uint64_t kPrime2 = 0xc2b2ae3d27d4eb4f;
 
-std::optional<std::uint32_t> GeeFS::GetBlockOffset(const INode &inode,
-                                                   std::size_t n) {
-  const auto kOfsPerBlock = super_block_.block_size / kBlockOfsSize;
-  if (n >= inode.block_num) return {};
-  if (n < kDirectBlockNum) {
-    return inode.direct[n];
+  static std::uint64_t Rotl(std::uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
   }
-  else if (n - kDirectBlockNum < kOfsPerBlock) {
-    auto offset = inode.indirect * super_block_.block_size;
-    offset += (n - kDirectBlockNum) * kBlockOfsSize;
-    if (!dev_.ReadAssert(kBlockOfsSize, offset, offset)) return {};
-    return offset;
-  }
-  else {
-    n -= kDirectBlockNum + kOfsPerBlock;
-    if (n >= kOfsPerBlock * kOfsPerBlock) return {};
-    auto offset = inode.indirect2 * super_block_.block_size;
-    offset += (n / kOfsPerBlock) * kBlockOfsSize;
-    if (!dev_.ReadAssert(kBlockOfsSize, offset, offset)) return {};
-    offset *= super_block_.block_size;
-    offset += (n % kOfsPerBlock) * kBlockOfsSize;
-    if (!dev_.ReadAssert(kBlockOfsSize, offset, offset)) return {};
-    return offset;
-  }
-}
 
-bool GeeFS::AppendBlock(INode &inode, std::uint32_t blk_ofs) {
-  const auto kOfsPerBlock = super_block_.block_size / kBlockOfsSize;
-  auto n = inode.block_num++;
-  if (n < kDirectBlockNum) {
-    inode.direct[n] = blk_ofs;
-    return true;
+  void UpdateWord(const char *data) {
+    std::uint64_t word;
+    std::memcpy(&word, data, sizeof(word));
+    hash_ = Rotl(hash_ ^ (word * kPrime2), 31) * kPrime1;
   }
-  else if (n - kDirectBlockNum < kOfsPerBlock) {
-    if (n == kDirectBlockNum) {
-      // allocate indirect block
-      auto blk_ofs = AllocDataBlock();
-      if (!blk_ofs) return false;
-      inode.indirect = *blk_ofs;
-    }
-    auto offset = inode.indirect * super_block_.block_size;
-    offset += (n - kDirectBlockNum) * kBlockOfsSize;
-    return dev_.WriteAssert(kBlockOfsSize, blk_ofs, offset);
-  }
-  else if (n - kDirectBlockNum - kOfsPerBlock <
-           kOfsPerBlock * kOfsPerBlock) {
-    n -= kDirectBlockNum + kOfsPerBlock;
-    if (!n) {
-      // allocate 2nd indirect block
-      auto blk_ofs = AllocDataBlock();
-      if (!blk_ofs) return false;
-      inode.indirect2 = *blk_ofs;
-    }
-    auto offset = inode.indirect2 * super_block_.block_size;
-    offset += (n / kOfsPerBlock) * kBlockOfsSize;
-    if (n % kOfsPerBlock) {
-      // initialize 2nd indirect block
-      auto blk_ofs = AllocDataBlock();
-      if (!blk_ofs) return false;
-      if (!dev_.WriteAssert(kBlockOfsSize, *blk_ofs, offset)) return false;
-      offset = *blk_ofs;
-    }
-    else {
-      if (!dev_.ReadAssert(kBlockOfsSize, offset, offset)) return false;
-    }
-    offset *= super_block_.block_size;
-    offset += (n % kOfsPerBlock) * kBlockOfsSize;
-    return dev_.WriteAssert(kBlockOfsSize, blk_ofs, offset);
-  }
-  else {
-    return false;
-  }
-}
 
-bool GeeFS::WalkEntry(std::function<bool(const Entry &)> callback) {
-  assert(cwd_.type == INodeType::Dir);
-  const auto kEntNum = cwd_.size / sizeof(Entry);
-  const auto kEntPerBlock = super_block_.block_size / sizeof(Entry);
-  // traverse data blocks
-  for (int i = 0; i < cwd_.block_num; ++i) {
-    // get offset
-    auto blk_ofs = GetBlockOffset(cwd_, i);
-    if (!blk_ofs) return false;
-    auto offset = *blk_ofs * super_block_.block_size;
-    // traverse entries in current block
-    auto entry_num = std::min(kEntNum - i * kEntPerBlock, kEntPerBlock);
-    for (int j = 0; j < entry_num; ++j) {
-      // read entry
-      auto ent_ofs = offset + j * sizeof(Entry);
-      Entry entry;
-      if (!dev_.ReadAssert(sizeof(Entry), entry, ent_ofs)) return false;
-      // invoke callback function
-      if (!callback(entry)) return false;
-    }
-  }
-  return true;
-}
+  std::uint64_t hash_;
+  char tail_[sizeof(std::uint64_t)];
+  std::size_t tail_len_;
+};
 
-bool GeeFS::AddEntry(std::uint32_t inode_id, std::string_view file_name) {
-  if (file_name.size() > kFileNameMaxLen - 1) return false;
-  // check if conflicted
-  auto ret = WalkEntry([&file_name](const Entry &entry) {
-    return file_name != reinterpret_cast<const char *>(entry.filename);
-  });
-  if (!ret) return false;
-  // get offset of entry that will be inserted
-  auto blk_ofs = GetBlockOffset(cwd_, cwd_.block_num - 1);
-  if (!blk_ofs) return false;
-  auto offset = *blk_ofs * super_block_.block_size;
-  auto ent_count = cwd_.size / sizeof(Entry);
-  assert(ent_count != 0);
-  auto ent_per_blk = super_block_.block_size / sizeof(Entry);
-  auto inblk_ofs = (ent_count % ent_per_blk) * sizeof(Entry);
-  if (inblk_ofs) {
-    offset += inblk_ofs;
-  }
-  else {
-    // allocate new block
-    auto blk_ofs = AllocDataBlock();
-    if (!blk_ofs || !AppendBlock(cwd_, *blk_ofs)) return false;
-    offset = *blk_ofs * super_block_.block_size;
-  }
-  // insert entry
-  Entry entry;
-  entry.inode_id = inode_id;
-  std::strcpy(reinterpret_cast<char *>(entry.filename),
-              std::string(file_name).c_str());
-  if (!dev_.WriteAssert(sizeof(Entry), entry, offset)) return false;
-  // update inode of cwd
-  cwd_.size += sizeof(Entry);
-  UpdateINode(cwd_, cwd_id_);
-  return true;
+std::uint64_t HashData(std::string_view data) {
+  ContentHasher hasher(data.size());
+  hasher.Update(data);
+  return hasher.Digest();
 }
 
+}  // namespace
+
 bool GeeFS::Create(std::uint32_t block_size, std::uint32_t free_map_num,
                    std::uint32_t inode_blk_num) {
-  if (block_size < sizeof(SuperBlockHeader) ||
-      block_size - sizeof(INodeBlockHeader) < sizeof(INode) ||
-      block_size < 2 * sizeof(Entry)) {
+  TraceSpan span("Create");
+  span.AddArg("block_size", block_size);
+  span.AddArg("free_map_num", free_map_num);
+  span.AddArg("inode_blk_num", inode_blk_num);
+  Flush();
+  // create engine by block size
+  engine_ = NewGeeFSEngine(dev_, block_size);
+  engine_->set_index_threshold(index_threshold_);
+  engine_->set_inline_data(inline_data_);
+  engine_->set_sparse(sparse_);
+  engine_->set_read_ahead_budget(read_ahead_budget_);
+  file_hashes_.clear();
+  if (!engine_->Create(free_map_num, inode_blk_num)) {
+    engine_.reset();
     return false;
   }
-  // resize device to image size
-  auto blk_num = 1 + free_map_num + inode_blk_num;
-  blk_num += (block_size - sizeof(FreeMapBlockHeader)) * 8 * free_map_num;
-  if (!dev_.Resize(blk_num * block_size)) return false;
-  // create buffer of empty block
-  std::vector<std::uint8_t> empty_blk;
-  empty_blk.resize(block_size, 0);
-  // initialize super block
-  super_block_ = {kMagicNum, sizeof(SuperBlockHeader), block_size,
-                  free_map_num, inode_blk_num};
-  if (!dev_.WriteAssert(sizeof(super_block_), super_block_, 0)) {
-    return false;
-  }
-  // initialize free map
-  for (int i = 0; i < free_map_num; ++i) {
-    auto offset = block_size * (1 + i);
-    if (!dev_.WriteAssert(block_size, empty_blk, offset)) return false;
-    FreeMapBlockHeader hdr = {
-      static_cast<std::uint32_t>((block_size - sizeof(hdr)) * 8)
-    };
-    if (!dev_.WriteAssert(sizeof(hdr), hdr, offset)) return false;
-  }
-  // initialize inode block
-  for (int i = 0; i < inode_blk_num; ++i) {
-    auto offset = block_size * (1 + free_map_num + i);
-    if (!dev_.WriteAssert(block_size, empty_blk, offset)) return false;
-    INodeBlockHeader hdr = {
-      static_cast<std::uint32_t>((block_size - sizeof(hdr)) / sizeof(INode))
-    };
-    if (!dev_.WriteAssert(sizeof(hdr), hdr, offset)) return false;
-  }
-  // initialize data blocks
-  auto data_blk_num = (block_size - sizeof(FreeMapBlockHeader)) * 8 *
-                      free_map_num;
-  for (int i = 0; i < data_blk_num; ++i) {
-    auto offset = block_size * (1 + free_map_num + inode_blk_num + i);
-    if (!dev_.WriteAssert(block_size, empty_blk, offset)) return false;
-  }
-  // initialize cwd as root directory
-  auto blk_ofs = AllocDataBlock(), inode_id = AllocINode();
-  assert(blk_ofs && inode_id);
-  cwd_ = {INodeType::Dir, 2 * sizeof(Entry), 1};
-  cwd_.direct[0] = *blk_ofs;
-  cwd_id_ = *inode_id;
-  UpdateINode(cwd_, cwd_id_);
-  InitDirBlock(*blk_ofs, cwd_id_, cwd_id_);
   // reset current path
   cur_path_.clear();
-  // sync
-  return dev_.Sync();
+  return true;
 }
 
 bool GeeFS::Open() {
+  TraceSpan span("Open");
   // read super block header
-  if (!dev_.ReadAssert(sizeof(super_block_), super_block_, 0)) {
+  SuperBlockHeader super_block;
+  if (!dev_.ReadAssert(sizeof(super_block), super_block, 0) ||
+      super_block.magic_num != kMagicNum) {
+    return false;
+  }
+  // features & preload manifest are not available in older images
+  if (super_block.header_size < offsetof(SuperBlockHeader, manifest)) {
+    super_block.features = 0;
+  }
+  if (super_block.header_size < sizeof(SuperBlockHeader)) {
+    super_block.manifest = 0;
+  }
+  // create engine by block size
+  Flush();
+  engine_ = NewGeeFSEngine(dev_, super_block.block_size);
+  engine_->set_index_threshold(index_threshold_);
+  engine_->set_inline_data(inline_data_);
+  engine_->set_sparse(sparse_);
+  engine_->set_read_ahead_budget(read_ahead_budget_);
+  file_hashes_.clear();
+  if (!engine_->Open(super_block)) {
+    engine_.reset();
     return false;
   }
-  // set root directory as cwd
-  if (!ReadINode(cwd_, 0)) return false;
-  cwd_id_ = 0;
   // reset current path
   cur_path_.clear();
-  return cwd_.type == INodeType::Dir;
+  return true;
 }
 
 bool GeeFS::Sync() {
-  return dev_.Sync();
+  auto ret = Flush();
+  return dev_.Sync() && ret;
+}
+
+bool GeeFS::Flush() {
+  TraceSpan span("Flush");
+  if (pool_ && !pool_->Wait()) jobs_failed_ = true;
+  return !jobs_failed_;
+}
+
+void GeeFS::set_jobs(std::size_t jobs) {
+  Flush();
+  if (jobs > 1) {
+    pool_ = std::make_unique<ThreadPool>(jobs);
+  }
+  else {
+    pool_.reset();
+  }
 }
 
 void GeeFS::List(std::ostream &os) {
-  auto ret = WalkEntry([this, &os](const Entry &entry) {
-    // get inode info
-    INode inode;
-    if (!ReadINode(inode, entry.inode_id)) return false;
-    // print to stream
-    os << std::left;
-    os << std::setw(7) << kTypeStr[static_cast<int>(inode.type)] << ' ';
-    os << std::setw(kFileNameMaxLen + 1) << entry.filename << ' ';
-    PrintFileSize(os, inode.size);
-    os << std::endl;
-    return true;
-  });
-  static_cast<void>(ret);
-  assert(ret);
+  TraceSpan span("List");
+  Flush();
+  if (engine_) engine_->List(os);
 }
 
 bool GeeFS::CreateFile(std::string_view file_name) {
-  // allocate new inode for file
-  auto inode_id = AllocINode();
-  if (!inode_id) return false;
-  // create new entry
-  if (!AddEntry(*inode_id, file_name)) return false;
-  // update allocated inode
-  INode inode = {INodeType::File};
-  UpdateINode(inode, *inode_id);
-  return true;
+  TraceSpan span("CreateFile");
+  span.AddArg("file", file_name);
+  return engine_ && engine_->CreateFile(file_name);
 }
 
 bool GeeFS::MakeDir(std::string_view dir_name) {
-  // allocate new inode for directory
-  auto inode_id = AllocINode();
-  if (!inode_id) return false;
-  // create new entry
-  if (!AddEntry(*inode_id, dir_name)) return false;
-  // allocate data block for directory
-  auto blk_ofs = AllocDataBlock();
-  if (!blk_ofs) return false;
-  // update allocated inode
-  INode inode = {INodeType::Dir, 2 * sizeof(Entry), 1, {*blk_ofs}};
-  UpdateINode(inode, *inode_id);
-  // initialize data block
-  InitDirBlock(*blk_ofs, *inode_id, cwd_id_);
-  return true;
+  TraceSpan span("MakeDir");
+  span.AddArg("dir", dir_name);
+  return engine_ && engine_->MakeDir(dir_name);
 }
 
 bool GeeFS::ChangeDir(std::string_view dir_name) {
-  // get inode by directory name
-  INode inode;
-  auto id = ReadINode(inode, dir_name);
-  if (!id || inode.type != INodeType::Dir) return false;
-  // change cwd
-  cwd_ = inode;
-  cwd_id_ = *id;
+  if (!engine_ || !engine_->ChangeDir(dir_name)) return false;
   // update current path
   if (dir_name != ".") {
-    if (dir_name == ".." && !cur_path_.empty()) {
-      cur_path_.pop_back();
+    if (dir_name == "..") {
+      if (!cur_path_.empty()) cur_path_.pop_back();
     }
     else {
       cur_path_.push_back(std::string(dir_name));
@@ -439,83 +193,173 @@ bool GeeFS::ChangeDir(std::string_view dir_name) {
 }
 
 bool GeeFS::Remove(std::string_view file_name) {
-  // TODO
-  return false;
+  return engine_ && engine_->Remove(file_name);
 }
 
 std::int32_t GeeFS::Read(std::string_view file_name, std::ostream &os,
                          std::size_t offset, std::size_t len) {
-  // get inode
-  INode inode;
-  if (!ReadINode(inode, file_name)) return -1;
-  // read file
-  std::int32_t data_len = 0;
-  auto end_len = std::min<std::size_t>(offset + len, inode.size);
-  for (int i = offset; i < end_len; ++i, ++data_len) {
-    // get block offset
-    auto n = i / super_block_.block_size;
-    if (n >= inode.block_num) break;
-    auto blk_ofs = GetBlockOffset(inode, n);
-    // get offset
-    auto ofs = *blk_ofs * super_block_.block_size;
-    ofs += i % super_block_.block_size;
-    // read to stream
-    std::uint8_t byte;
-    if (!dev_.ReadAssert(1, byte, ofs)) break;
-    os.write(reinterpret_cast<const char *>(&byte), 1);
-  }
-  return data_len;
+  TraceSpan span("Read");
+  span.AddArg("file", file_name);
+  span.AddArg("offset", offset);
+  if (!engine_) return -1;
+  Flush();
+  auto ret = engine_->Read(file_name, os, offset, len);
+  span.AddArg("bytes", ret);
+  return ret;
 }
 
 std::int32_t GeeFS::Write(std::string_view file_name, std::istream &is,
                           std::size_t offset, std::size_t len) {
-  // get inode
-  INode inode;
-  auto id = ReadINode(inode, file_name);
-  if (!id) return -1;
-  // expand file size if necessary
-  if (offset > inode.size) {
-    std::vector<std::uint8_t> buffer;
-    buffer.resize(super_block_.block_size, 0);
-    // allocate empty data blocks
-    auto blk_num = (offset + (super_block_.block_size - 1)) /
-                   super_block_.block_size;
-    for (int i = inode.block_num + 1; i < blk_num; ++i) {
-      auto blk_ofs = AllocDataBlock();
-      if (!blk_ofs || !AppendBlock(inode, *blk_ofs) ||
-          !dev_.WriteAssert(buffer.size(), buffer,
-                            *blk_ofs * super_block_.block_size)) {
-        return -1;
+  TraceSpan span("Write");
+  span.AddArg("file", file_name);
+  span.AddArg("offset", offset);
+  if (!engine_) return -1;
+  Flush();
+  auto ret = engine_->Write(file_name, is, offset, len);
+  span.AddArg("bytes", ret);
+  return ret;
+}
+
+bool GeeFS::AddFile(std::string_view file_name, std::istream &is,
+                    std::size_t size) {
+  TraceSpan span("AddFile");
+  span.AddArg("file", file_name);
+  span.AddArg("bytes", size);
+  if (!engine_) return false;
+  if ((!dedup_ || !size) && !pool_ && !preload_) {
+    return CreateFile(file_name) && Write(file_name, is, 0, size) == size;
+  }
+  // large files are written synchronously, rather than held in memory
+  // until worker threads are available
+  if (size > kMaxBufferedSize) return AddLargeFile(file_name, is, size);
+  // read the whole file
+  auto data = std::make_shared<std::string>(size, '\0');
+  is.read(data->data(), size);
+  if (is.gcount() != size) return false;
+  // find previously added files with the same content
+  auto dedup = dedup_ && size;
+  auto hash = dedup ? HashData(*data) : 0;
+  if (dedup && file_hashes_.count(hash)) {
+    // wait for pending writes before comparing
+    Flush();
+    auto [first, last] = file_hashes_.equal_range(hash);
+    for (auto it = first; it != last; ++it) {
+      std::ostringstream oss;
+      if (engine_->ReadINodeData(it->second, oss, 0, size + 1) == size &&
+          oss.str() == *data && engine_->Link(it->second, file_name)) {
+        span.AddArg("link", it->second);
+        return true;
       }
     }
-    // update file size
-    inode.size = offset;
   }
-  // write to file
-  std::int32_t data_len = 0;
-  for (int i = offset; i < offset + len; ++i, ++data_len) {
-    // get block offset
-    auto n = i / super_block_.block_size;
-    std::optional<std::uint32_t> blk_ofs;
-    if (n < inode.block_num) {
-      blk_ofs = GetBlockOffset(inode, n);
-      if (!blk_ofs) return -1;
+  // create a new file
+  if (!CreateFile(file_name)) return false;
+  auto id = engine_->GetINodeId(file_name);
+  if (!id) return false;
+  if (dedup) file_hashes_.insert({hash, *id});
+  // store executables contiguously and list them in preload manifest
+  PreloadEntry entry;
+  if (preload_ && ParseExecutable(*data, size, entry)) {
+    std::istringstream iss(*data);
+    if (engine_->WriteINodeExtent(*id, iss, size, entry.first_block) !=
+        size) {
+      return false;
     }
-    else {
-      // allocate a new data block
-      blk_ofs = AllocDataBlock();
-      if (!blk_ofs) break;
-      if (!AppendBlock(inode, *blk_ofs)) return -1;
+    // executables not in manifest can still be loaded normally
+    if (entry.first_block) {
+      span.AddArg("extent", entry.first_block);
+      entry.inode_id = *id;
+      engine_->AddPreloadEntry(entry);
+    }
+    return true;
+  }
+  // write file content, by worker threads if possible
+  auto write = [this, id = *id, data] {
+    std::istringstream iss(*data);
+    auto size = data->size();
+    return engine_->WriteINodeData(id, iss, 0, size) == size;
+  };
+  if (!pool_) return write();
+  pool_->Submit(write);
+  return true;
+}
+
+bool GeeFS::AddLargeFile(std::string_view file_name, std::istream &is,
+                         std::size_t size) {
+  TraceSpan span("AddLargeFile");
+  span.AddArg("file", file_name);
+  span.AddArg("bytes", size);
+  // hash the file and parse its header, then rewind the stream
+  // non-seekable streams (e.g. tar archive from stdin) are written as is
+  auto start = is.tellg();
+  if (start == std::istream::pos_type(-1)) is.clear();
+  std::vector<char> buf(kStreamBufferSize);
+  std::uint64_t hash = 0;
+  PreloadEntry entry;
+  bool exec = false;
+  auto seekable = start != std::istream::pos_type(-1);
+  if (seekable && (dedup_ || preload_)) {
+    ContentHasher hasher(size);
+    for (std::size_t ofs = 0; ofs < size; ofs += buf.size()) {
+      auto len = std::min(buf.size(), size - ofs);
+      if (!is.read(buf.data(), len)) return false;
+      if (!ofs && preload_) {
+        exec = ParseExecutable({buf.data(), len}, size, entry);
+      }
+      hasher.Update({buf.data(), len});
+    }
+    hash = hasher.Digest();
+    // find previously added files with the same content
+    if (dedup_ && file_hashes_.count(hash)) {
+      // wait for pending writes before comparing
+      Flush();
+      auto [first, last] = file_hashes_.equal_range(hash);
+      for (auto it = first; it != last; ++it) {
+        if (CompareFile(it->second, is, start, size, buf) &&
+            engine_->Link(it->second, file_name)) {
+          span.AddArg("link", it->second);
+          return !!is.seekg(start + std::istream::off_type(size));
+        }
+      }
+    }
+    if (!is.seekg(start)) return false;
+  }
+  // create a new file
+  if (!CreateFile(file_name)) return false;
+  auto id = engine_->GetINodeId(file_name);
+  if (!id) return false;
+  if (dedup_ && seekable) file_hashes_.insert({hash, *id});
+  // store executables contiguously and list them in preload manifest
+  if (exec) {
+    if (engine_->WriteINodeExtent(*id, is, size, entry.first_block) !=
+        size) {
+      return false;
+    }
+    if (entry.first_block) {
+      span.AddArg("extent", entry.first_block);
+      entry.inode_id = *id;
+      engine_->AddPreloadEntry(entry);
+    }
+    return true;
+  }
+  return engine_->WriteINodeData(*id, is, 0, size) == size;
+}
+
+bool GeeFS::CompareFile(std::uint32_t inode_id, std::istream &is,
+                        std::istream::pos_type pos, std::size_t size,
+                        std::vector<char> &buf) {
+  if (!is.seekg(pos)) return false;
+  std::ostringstream oss;
+  for (std::size_t ofs = 0; ofs < size; ofs += buf.size()) {
+    auto len = std::min(buf.size(), size - ofs);
+    oss.str({});
+    if (engine_->ReadINodeData(inode_id, oss, ofs, len) != len ||
+        !is.read(buf.data(), len) ||
+        oss.str().compare(0, len, buf.data(), len)) {
+      return false;
     }
-    // write to block
-    auto ofs = *blk_ofs * super_block_.block_size;
-    ofs += i % super_block_.block_size;
-    std::uint8_t byte;
-    is.read(reinterpret_cast<char *>(&byte), 1);
-    if (!dev_.WriteAssert(1, byte, ofs)) break;
   }
-  // update inode
-  if (offset + data_len > inode.size) inode.size = offset + data_len;
-  UpdateINode(inode, *id);
-  return data_len;
+  // the file must not be longer
+  oss.str({});
+  return !engine_->ReadINodeData(inode_id, oss, size, 1);
 }
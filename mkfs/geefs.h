@@ -4,14 +4,17 @@
 #include <istream>
 #include <ostream>
 #include <string_view>
-#include <optional>
-#include <functional>
+#include <memory>
+#include <unordered_map>
 #include <string>
 #include <vector>
 #include <cstddef>
 
 #include "device.h"
 #include "structs.h"
+#include "engine.h"
+#include "readahead.h"
+#include "threadpool.h"
 
 class GeeFS {
  public:
@@ -25,6 +28,9 @@ class GeeFS {
   bool Open();
   // sync all modifications to device
   bool Sync();
+  // wait for all files that are being added by worker threads
+  // returns false if any of them failed
+  bool Flush();
 
   // list all files/dirs in cwd
   void List(std::ostream &os);
@@ -42,6 +48,54 @@ class GeeFS {
   // write input stream to file in cwd
   std::int32_t Write(std::string_view file_name, std::istream &is,
                      std::size_t offset, std::size_t len);
+  // create new file in cwd and write 'size' bytes of input stream to it
+  // hard-links the file to a previously added one if deduplicating and
+  // they have the same content, files larger than 1 MiB are streamed
+  // through a fixed-size buffer, and only deduplicated or preloaded if
+  // the stream is seekable
+  // content of files up to 1 MiB is written by worker threads if there
+  // are multiple jobs, call 'Flush' to wait for them
+  bool AddFile(std::string_view file_name, std::istream &is,
+               std::size_t size);
+
+  // set the entry number that directories will be converted to
+  // indexed form when exceeding it, 0 means never converting
+  void set_index_threshold(std::uint32_t index_threshold) {
+    index_threshold_ = index_threshold;
+    if (engine_) engine_->set_index_threshold(index_threshold);
+  }
+
+  // set if small files should be stored inside their inodes
+  void set_inline_data(bool inline_data) {
+    inline_data_ = inline_data;
+    if (engine_) engine_->set_inline_data(inline_data);
+  }
+
+  // set if all-zero blocks should be left as holes
+  void set_sparse(bool sparse) {
+    sparse_ = sparse;
+    if (engine_) engine_->set_sparse(sparse);
+  }
+
+  // set if added executables should be listed in preload manifest
+  void set_preload(bool preload) { preload_ = preload; }
+
+  // set memory budget of read-ahead in bytes, 0 means disabling it
+  void set_read_ahead_budget(std::size_t budget) {
+    read_ahead_budget_ = budget;
+    if (engine_) engine_->set_read_ahead_budget(budget);
+  }
+
+  // set if files with the same content should be hard-linked
+  void set_dedup(bool dedup) { dedup_ = dedup; }
+
+  // set number of worker threads for adding files
+  void set_jobs(std::size_t jobs);
+
+  // get counters of read-ahead
+  ReadAheadStats read_ahead_stats() const {
+    return engine_ ? engine_->read_ahead_stats() : ReadAheadStats();
+  }
 
   // get current path
   std::string cur_path() const {
@@ -56,40 +110,39 @@ class GeeFS {
   }
 
  private:
-  // allocate a data block, returns block offset
-  std::optional<std::uint32_t> AllocDataBlock();
-  // allocate an inode, returns inode id
-  std::optional<std::uint32_t> AllocINode();
-  // initialize data block of directory
-  void InitDirBlock(std::uint32_t blk_ofs, std::uint32_t cur_id,
-                    std::uint32_t parent_id);
-  // update inode by id
-  void UpdateINode(const INode &inode, std::uint32_t id);
-  // read inode by id
-  bool ReadINode(INode &inode, std::uint32_t id);
-  // read inode by file name, returns inode id
-  std::optional<std::uint32_t> ReadINode(INode &inode,
-                                         std::string_view name);
-  // get nth data block offset of inode
-  std::optional<std::uint32_t> GetBlockOffset(const INode &inode,
-                                              std::size_t n);
-  // append block to inode
-  bool AppendBlock(INode &inode, std::uint32_t blk_ofs);
-  // traverse all entries of cwd
-  bool WalkEntry(std::function<bool(const Entry &)> callback);
-  // add new entry in cwd
-  bool AddEntry(std::uint32_t inode_id, std::string_view file_name);
+  // add a file by streaming it, instead of reading it into memory
+  bool AddLargeFile(std::string_view file_name, std::istream &is,
+                    std::size_t size);
+  // check if file has the same content as 'size' bytes of input stream
+  // at 'pos', 'buf' is used for reading the stream
+  bool CompareFile(std::uint32_t inode_id, std::istream &is,
+                   std::istream::pos_type pos, std::size_t size,
+                   std::vector<char> &buf);
 
   // low-level device
   Device &dev_;
-  // super block of disk
-  SuperBlockHeader super_block_;
-  // current working directory
-  INode cwd_;
-  // inode id of cwd
-  std::uint32_t cwd_id_;
+  // engine specialized for block size of current image
+  std::unique_ptr<GeeFSEngineBase> engine_;
   // current path
   std::vector<std::string> cur_path_;
+  // threshold of indexed directories
+  std::uint32_t index_threshold_ = 0;
+  // enable inline data
+  bool inline_data_ = false;
+  // enable sparse files
+  bool sparse_ = false;
+  // enable preload manifest
+  bool preload_ = false;
+  // memory budget of read-ahead
+  std::size_t read_ahead_budget_ = kDefaultReadAheadBudget;
+  // enable deduplication
+  bool dedup_ = false;
+  // inode ids of added files, indexed by content hash
+  std::unordered_multimap<std::uint64_t, std::uint32_t> file_hashes_;
+  // worker threads for adding files, must be destructed before engine
+  std::unique_ptr<ThreadPool> pool_;
+  // set if any worker failed
+  bool jobs_failed_ = false;
 };
 
 #endif  // GEEOS_MKFS_GEEFS_H_
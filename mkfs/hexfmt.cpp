@@ -0,0 +1,167 @@
+#include "hexfmt.h"
+
+#include <algorithm>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+
+namespace {
+
+// address of the first word in memory
+constexpr std::uint32_t kImageBase = 128;
+// size of buffer for reading from device
+constexpr std::size_t kReadBufSize = 64 * 1024;
+// size of buffer for writing to stream
+constexpr std::size_t kWriteBufSize = 64 * 1024;
+
+// convert 32-bit word to 8 lowercase hex digits, MSB first
+// all 8 nibbles are converted at once (SWAR), without any branches
+inline void EncodeWord(std::uint32_t word, char *str) {
+  // spread nibbles to bytes, the lowest nibble goes to the lowest byte
+  std::uint64_t x = word;
+  x = ((x & 0xffff0000ull) << 16) | (x & 0x0000ffffull);
+  x = ((x & 0x0000ff000000ff00ull) << 8) | (x & 0x000000ff000000ffull);
+  x = ((x & 0x00f000f000f000f0ull) << 4) | (x & 0x000f000f000f000full);
+  // make the highest nibble the first character
+  x = __builtin_bswap64(x);
+  // get '0'-'9' or 'a'-'f', 'mask' is 1 in bytes that greater than 9
+  auto mask = ((x + 0x0606060606060606ull) >> 4) & 0x0101010101010101ull;
+  x += 0x3030303030303030ull + mask * ('a' - '0' - 10);
+  std::memcpy(str, &x, sizeof(x));
+}
+
+// buffered writer of hex memory images
+class HexWriter {
+ public:
+  HexWriter(std::ostream &os, HexFormat format)
+      : os_(os), format_(format), pos_(0), addr_(kImageBase) {
+    buf_.resize(kWriteBufSize);
+  }
+
+  // write file header
+  void WriteHeader() {
+    switch (format_) {
+      case HexFormat::Coe: {
+        Put("memory_initialization_radix = 16;\n");
+        Put("memory_initialization_vector =\n");
+        for (std::uint32_t i = 0; i < kImageBase; ++i) Put("00000000\n");
+        break;
+      }
+      case HexFormat::VerilogHex: {
+        Put("@");
+        PutWord(kImageBase);
+        Put("\n");
+        break;
+      }
+      default:;
+    }
+  }
+
+  // write words
+  void WriteWords(const std::uint8_t *data, std::size_t count) {
+    for (std::size_t i = 0; i < count; ++i) {
+      std::uint32_t word;
+      std::memcpy(&word, data + i * sizeof(word), sizeof(word));
+      if (format_ == HexFormat::IntelHex) {
+        PutIntelHexWord(word);
+      }
+      else {
+        // reserve space for a word and a new line
+        if (pos_ + 9 > buf_.size()) Flush();
+        EncodeWord(word, buf_.data() + pos_);
+        buf_[pos_ + 8] = '\n';
+        pos_ += 9;
+      }
+      ++addr_;
+    }
+  }
+
+  // write file tail
+  void WriteTail() {
+    if (format_ == HexFormat::IntelHex) Put(":00000001FF\n");
+  }
+
+  // flush buffer to stream
+  bool Flush() {
+    os_.write(buf_.data(), pos_);
+    pos_ = 0;
+    return !!os_;
+  }
+
+ private:
+  // put string to buffer
+  void Put(std::string_view str) {
+    if (pos_ + str.size() > buf_.size()) Flush();
+    std::memcpy(buf_.data() + pos_, str.data(), str.size());
+    pos_ += str.size();
+  }
+
+  // put a word as 8 hex digits to buffer
+  void PutWord(std::uint32_t word) {
+    char str[8];
+    EncodeWord(word, str);
+    Put(std::string_view(str, sizeof(str)));
+  }
+
+  // put Intel HEX record to buffer
+  void PutRecord(std::uint8_t type, std::uint16_t addr,
+                 std::uint32_t data, std::uint8_t len) {
+    // header of record
+    std::uint32_t hdr = (len << 24) | (addr << 8) | type;
+    std::uint8_t sum = len + (addr >> 8) + addr + type;
+    for (int i = 0; i < len; ++i) sum += data >> (i * 8);
+    // encode record, data is in big-endian
+    char str[8];
+    Put(":");
+    EncodeWord(hdr, str);
+    Put(std::string_view(str, sizeof(str)));
+    EncodeWord(data, str);
+    Put(std::string_view(str + (4 - len) * 2, len * 2));
+    EncodeWord(static_cast<std::uint8_t>(-sum), str);
+    Put(std::string_view(str + 6, 2));
+    Put("\n");
+  }
+
+  // put a word as Intel HEX data record, addressed by word
+  void PutIntelHexWord(std::uint32_t word) {
+    // emit extended linear address record if necessary
+    if (addr_ == kImageBase || !(addr_ & 0xffff)) {
+      PutRecord(0x04, 0, addr_ >> 16, 2);
+    }
+    PutRecord(0x00, addr_, word, 4);
+  }
+
+  std::ostream &os_;
+  HexFormat format_;
+  std::vector<char> buf_;
+  std::size_t pos_;
+  // current word address
+  std::uint32_t addr_;
+};
+
+}  // namespace
+
+std::optional<HexFormat> GetHexFormat(std::string_view name) {
+  if (name == "coe") return HexFormat::Coe;
+  if (name == "ihex") return HexFormat::IntelHex;
+  if (name == "vmem") return HexFormat::VerilogHex;
+  return {};
+}
+
+bool WriteHexImage(Device &dev, std::size_t size, HexFormat format,
+                   std::ostream &os) {
+  HexWriter writer(os, format);
+  std::vector<std::uint8_t> buf(kReadBufSize);
+  writer.WriteHeader();
+  for (std::size_t ofs = 0; ofs < size; ofs += buf.size()) {
+    auto len = std::min(buf.size(), size - ofs);
+    if (!dev.ReadAssert(len, buf.data(), len, ofs)) return false;
+    // pad the last word with zeros
+    auto word_num = (len + 3) / 4;
+    std::fill(buf.begin() + len, buf.begin() + word_num * 4, 0);
+    writer.WriteWords(buf.data(), word_num);
+    if (!writer.Flush()) return false;
+  }
+  writer.WriteTail();
+  return writer.Flush();
+}
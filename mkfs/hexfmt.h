@@ -0,0 +1,27 @@
+#ifndef GEEOS_MKFS_HEXFMT_H_
+#define GEEOS_MKFS_HEXFMT_H_
+
+#include <ostream>
+#include <string_view>
+#include <optional>
+#include <cstddef>
+
+#include "device.h"
+
+// formats of FPGA memory initialization files
+// all formats use 32-bit little-endian words, and start from word 128,
+// which is compatible with 'utils/bin2coe.py'
+enum class HexFormat {
+  Coe,          // Xilinx COE
+  IntelHex,     // Intel HEX
+  VerilogHex,   // Verilog '$readmemh'
+};
+
+// get hex format by name
+std::optional<HexFormat> GetHexFormat(std::string_view name);
+
+// write the first 'size' bytes of device to stream in specific format
+bool WriteHexImage(Device &dev, std::size_t size, HexFormat format,
+                   std::ostream &os);
+
+#endif  // GEEOS_MKFS_HEXFMT_H_
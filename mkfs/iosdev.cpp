@@ -4,6 +4,7 @@
 
 std::int32_t IOStreamDevice::Read(std::uint8_t *buf, std::size_t len,
                                   std::size_t offset) {
+  std::lock_guard<std::mutex> lock(lock_);
   if (offset >= size_) return -1;
   ios_.seekg(offset);
   auto size = std::min<std::size_t>(size_ - offset, len);
@@ -14,6 +15,7 @@ std::int32_t IOStreamDevice::Read(std::uint8_t *buf, std::size_t len,
 std::int32_t IOStreamDevice::Write(const std::uint8_t *buf,
                                    std::size_t len,
                                    std::size_t offset) {
+  std::lock_guard<std::mutex> lock(lock_);
   if (offset >= size_) return -1;
   ios_.seekp(offset);
   auto size = std::min<std::size_t>(size_ - offset, len);
@@ -22,11 +24,13 @@ std::int32_t IOStreamDevice::Write(const std::uint8_t *buf,
 }
 
 bool IOStreamDevice::Sync() {
+  std::lock_guard<std::mutex> lock(lock_);
   ios_.flush();
   return !!ios_;
 }
 
 bool IOStreamDevice::Resize(std::size_t size) {
+  std::lock_guard<std::mutex> lock(lock_);
   ios_.seekp(size - 1);
   ios_ << '\0';
   size_ = size;
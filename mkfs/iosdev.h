@@ -2,9 +2,11 @@
 #define GEEOS_MKFS_IOSDEV_H_
 
 #include <iostream>
+#include <mutex>
 
 #include "device.h"
 
+// device backed by a stream, all operations are thread-safe
 class IOStreamDevice : public DeviceBase {
  public:
   IOStreamDevice(std::iostream &ios) : ios_(ios) {
@@ -23,6 +25,7 @@ class IOStreamDevice : public DeviceBase {
  private:
   std::iostream &ios_;
   std::size_t size_;
+  std::mutex lock_;
 };
 
 #endif  // GEEOS_MKFS_IOSDEV_H_
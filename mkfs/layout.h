@@ -0,0 +1,46 @@
+#ifndef GEEOS_MKFS_LAYOUT_H_
+#define GEEOS_MKFS_LAYOUT_H_
+
+#include <array>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// block layout whose block size is known at compile time
+// divisions and modulos by block size will be folded into shifts & masks
+template <std::uint32_t BlockSize>
+class FixedLayout {
+ public:
+  static_assert(BlockSize && !(BlockSize & (BlockSize - 1)),
+                "block size must be a power of 2");
+
+  // buffer that can hold exactly one block, allocated on stack
+  using Buffer = std::array<std::uint8_t, BlockSize>;
+
+  explicit FixedLayout(std::uint32_t) {}
+
+  // create a new zero-filled block buffer
+  static Buffer NewBuffer() { return Buffer(); }
+
+  static constexpr std::uint32_t block_size() { return BlockSize; }
+};
+
+// block layout whose block size is only known at runtime
+class DynamicLayout {
+ public:
+  // buffer that can hold exactly one block, allocated on heap
+  using Buffer = std::vector<std::uint8_t>;
+
+  explicit DynamicLayout(std::uint32_t block_size)
+      : block_size_(block_size) {}
+
+  // create a new zero-filled block buffer
+  Buffer NewBuffer() const { return Buffer(block_size_, 0); }
+
+  std::uint32_t block_size() const { return block_size_; }
+
+ private:
+  std::uint32_t block_size_;
+};
+
+#endif  // GEEOS_MKFS_LAYOUT_H_
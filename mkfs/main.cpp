@@ -2,25 +2,95 @@
 #include <string_view>
 #include <iostream>
 #include <sstream>
+#include <optional>
+#include <memory>
 #include <cstddef>
 
 #include "geefs.h"
 #include "iosdev.h"
+#include "filedev.h"
+#include "memdev.h"
+#include "overlaydev.h"
+#include "uringdev.h"
+#include "hexfmt.h"
+#include "tar.h"
+#include "transfer.h"
+#include "trace.h"
+#include "structs.h"
 
 using namespace std;
 
 namespace {
 
+// size of each buffer of asynchronous device
+constexpr size_t kAsyncBufferSize = 4096;
+
 void PrintHelp() {
   cout << "mkfs utility for GeeFS, by MaxXing" << endl;
   cout << "usage: mkfs [-h] image [-i]" << endl;
   cout << "            [-c blk_size free_map_num inode_blk_num]" << endl;
-  cout << "            [-a file ...]" << endl << endl;
+  cout << "            [-a file ...] [--from-tar file]" << endl;
+  cout << "            [--format raw|coe|ihex|vmem]" << endl;
+  cout << "            [--index-dir entry_num] [--inline-data]" << endl;
+  cout << "            [--async queue_depth] [--read-ahead kbytes]" << endl;
+  cout << "            [--trace file] [--dedup] [--jobs n] [--sparse]"
+       << endl;
+  cout << "            [--base file] [--flatten file] [--preload]" << endl;
+  cout << "            [--in-memory] [--transfer file]" << endl;
+  cout << "            [--transfer-base file]" << endl << endl;
   cout << "options:" << endl;
   cout << "  -h         display this message" << endl;
   cout << "  -i         interactive mode" << endl;
   cout << "  -c         create a new GeeFS image" << endl;
   cout << "  -a         add files to current image" << endl;
+  cout << "  --from-tar add all files in tar archive to current image,"
+       << endl;
+  cout << "             read archive from stdin if file is '-'" << endl;
+  cout << "  --format   write image as raw binary (default), Xilinx COE,"
+       << endl;
+  cout << "             Intel HEX or Verilog $readmemh file" << endl;
+  cout << "  --index-dir convert directories with more than entry_num"
+       << endl;
+  cout << "             entries to indexed form when adding files" << endl;
+  cout << "  --inline-data store data of small files inside their inodes"
+       << endl;
+  cout << "  --async    access raw image using io_uring with at most"
+       << endl;
+  cout << "             queue_depth requests in flight" << endl;
+  cout << "  --read-ahead set memory budget of read-ahead when reading"
+       << endl;
+  cout << "             files sequentially, 0 means disabling it" << endl;
+  cout << "  --trace    write timed spans of GeeFS operations to file"
+       << endl;
+  cout << "             in Chrome trace event format" << endl;
+  cout << "  --dedup    hard-link added files with the same content" << endl;
+  cout << "  --jobs     write contents of added files using n threads"
+       << endl;
+  cout << "  --sparse   leave all-zero blocks of added files as holes"
+       << endl;
+  cout << "  --base     treat image as an overlay of base image, which"
+       << endl;
+  cout << "             only stores blocks changed from base image" << endl;
+  cout << "  --flatten  merge overlay & base image into a standalone image"
+       << endl;
+  cout << "  --preload  store added executables contiguously and list them"
+       << endl;
+  cout << "             in preload manifest for faster loading" << endl;
+  cout << "  --in-memory build raw image in memory and write it to file"
+       << endl;
+  cout << "             when exiting, enables 'snapshot' and 'restore'"
+       << endl;
+  cout << "             commands in interactive mode" << endl;
+  cout << "  --transfer write non-zero blocks of image to file as a compact"
+       << endl;
+  cout << "             transfer stream, for measuring and checking transfers"
+       << endl;
+  cout << "             by 'utils/uartloop.py' (not bootable, send the kernel"
+       << endl;
+  cout << "             ELF by 'utils/uart.py --compact' instead)" << endl;
+  cout << "  --transfer-base only write blocks that differ from the given"
+       << endl;
+  cout << "             image to transfer stream" << endl;
 }
 
 int LogError(string_view msg) {
@@ -28,15 +98,14 @@ int LogError(string_view msg) {
   return 1;
 }
 
-IOStreamDevice GetDeviceFromFile(fstream &fs, string_view file_name) {
-  fs.open(file_name, ios::binary | ios::in | ios::out);
+void OpenImageFile(fstream &fs, string_view file_name) {
+  fs.open(string(file_name), ios::binary | ios::in | ios::out);
   if (!fs.is_open()) {
     fs.clear();
-    fs.open(file_name, ios::out);
+    fs.open(string(file_name), ios::out);
     fs.close();
-    fs.open(file_name, ios::binary | ios::in | ios::out);
+    fs.open(string(file_name), ios::binary | ios::in | ios::out);
   }
-  return IOStreamDevice(fs);
 }
 
 size_t GetStreamSize(istream &is) {
@@ -59,8 +128,111 @@ string_view GetFileName(string_view path) {
   return path.substr(pos + 1);
 }
 
-int EnterIMode(GeeFS &geefs) {
+// get block size of base image, which is also the chunk size of overlay
+bool GetBaseBlockSize(const char *file, uint32_t &block_size) {
+  ifstream ifs(file, ios::binary);
+  SuperBlockHeader super_block;
+  if (!ifs.read(reinterpret_cast<char *>(&super_block), sizeof(super_block)) ||
+      super_block.magic_num != kMagicNum) {
+    return false;
+  }
+  block_size = super_block.block_size;
+  return true;
+}
+
+int FlattenImage(GeeFS &geefs, OverlayDevice &overlay, const char *file) {
+  if (!geefs.Sync()) return LogError("can not write image");
+  auto dev = FileDevice();
+  if (!dev.Open(file) || !dev.Resize(overlay.size()) ||
+      !overlay.Flatten(dev)) {
+    return LogError("can not flatten image");
+  }
+  return 0;
+}
+
+int ImportTar(GeeFS &geefs, istream &is) {
+  auto importer = TarImporter(geefs);
+  if (!importer.Import(is)) {
+    return LogError("can not import tar archive: " + importer.error());
+  }
+  if (!geefs.Flush()) return LogError("can not write file in image");
+  return 0;
+}
+
+int ImportTar(GeeFS &geefs, const char *file) {
+  ifstream ifs(file, ios::binary);
+  if (!ifs) return LogError("can not open tar archive");
+  return ImportTar(geefs, ifs);
+}
+
+int LoadImageFile(MemDevice &dev, const char *file) {
+  // image file does not exist, start with an empty device
+  ifstream ifs(file, ios::binary);
+  if (!ifs) return 0;
+  if (!dev.Load(ifs, GetStreamSize(ifs))) {
+    return LogError("can not read image");
+  }
+  return 0;
+}
+
+int SaveImageFile(GeeFS &geefs, MemDevice &dev, const char *file) {
+  if (!geefs.Sync()) return LogError("can not write image");
+  if (!dev.modified()) return 0;
+  ofstream ofs(file, ios::binary);
+  if (!ofs || !dev.Save(ofs)) return LogError("can not write image");
+  return 0;
+}
+
+int WriteHexFile(MemDevice &dev, HexFormat format, const char *file) {
+  ofstream ofs(file);
+  if (!ofs || !WriteHexImage(dev, dev.size(), format, ofs)) {
+    return LogError("can not write hex image");
+  }
+  return 0;
+}
+
+int WriteTransferFile(GeeFS &geefs, Device &dev, const char *file,
+                      const char *base_file) {
+  if (!geefs.Sync()) return LogError("can not write image");
+  // open previous image
+  ifstream base;
+  size_t base_size = 0;
+  if (base_file) {
+    base.open(base_file, ios::binary);
+    if (!base) return LogError("can not open previous image");
+    base_size = GetStreamSize(base);
+  }
+  // write stream
+  ofstream ofs(file, ios::binary);
+  TransferStats stats;
+  if (!ofs || !WriteTransferStream(dev, base_file ? &base : nullptr,
+                                   base_size, ofs, stats)) {
+    return LogError("can not write transfer stream");
+  }
+  cout << "transfer stream: " << stats.stream_size << " of "
+       << stats.image_size << " bytes, " << stats.run_num << " runs"
+       << endl;
+  return 0;
+}
+
+void PrintReadAheadStats(const GeeFS &geefs) {
+  auto stats = geefs.read_ahead_stats();
+  cout << "read-ahead hits:       " << stats.hits << endl;
+  cout << "read-ahead misses:     " << stats.misses << endl;
+  cout << "read-ahead prefetched: " << stats.prefetched << endl;
+  cout << "read-ahead wasted:     " << stats.wasted << endl;
+}
+
+int WriteTraceFile(const char *file) {
+  StopTrace();
+  ofstream ofs(file);
+  if (!ofs || !WriteTrace(ofs)) return LogError("can not write trace");
+  return 0;
+}
+
+int EnterIMode(GeeFS &geefs, MemDevice *mem_dev) {
   string line;
+  optional<MemSnapshot> snapshot;
   // print prompt
   cout << geefs.cur_path() << "> ";
   while (getline(cin, line)) {
@@ -95,6 +267,27 @@ int EnterIMode(GeeFS &geefs) {
       else if (line.substr(0, 4) == "read") {
         geefs.Read(line.substr(5), cout, 0, -1);
       }
+      else if (line == "stat") {
+        PrintReadAheadStats(geefs);
+      }
+      else if (line == "snapshot" || line == "restore") {
+        if (!mem_dev) {
+          LogError("image is not in memory");
+        }
+        else if (line == "snapshot") {
+          geefs.Flush();
+          snapshot = mem_dev->Snapshot();
+        }
+        else if (!snapshot) {
+          LogError("no snapshot");
+        }
+        else {
+          // reopen image, since states of GeeFS are also restored
+          geefs.Flush();
+          mem_dev->Restore(*snapshot);
+          if (!geefs.Open()) LogError("failed to restore snapshot");
+        }
+      }
       else {
         LogError("unknown command");
       }
@@ -106,19 +299,142 @@ int EnterIMode(GeeFS &geefs) {
   return 0;
 }
 
-}  // namespace
-
-int main(int argc, const char *argv[]) {
+// run mkfs, the trace file is returned even if failed
+int RunMkfs(int argc, const char *argv[], const char *&trace_file) {
   // print help message
   if (argc < 2 || argv[1] == "-h"sv) {
     PrintHelp();
     return argc < 2;
   }
 
+  // get format of image, queue depth of asynchronous I/O, trace file,
+  // number of worker threads, base image, flattened image & transfer
+  // stream
+  optional<HexFormat> hex_format;
+  uint32_t queue_depth = 0, jobs = 1;
+  const char *base_file = nullptr;
+  const char *flatten_file = nullptr, *transfer_file = nullptr;
+  const char *transfer_base = nullptr;
+  bool in_memory = false;
+  for (int i = 2; i < argc; ++i) {
+    if (argv[i] == "--format"sv) {
+      if (argc - i - 1 < 1) return LogError("insufficient argument");
+      hex_format = GetHexFormat(argv[++i]);
+      if (!hex_format && argv[i] != "raw"sv) {
+        return LogError("invalid image format");
+      }
+    }
+    else if (argv[i] == "--async"sv) {
+      if (argc - i - 1 < 1) return LogError("insufficient argument");
+      if (!GetInteger(argv[++i], queue_depth) || !queue_depth) {
+        return LogError("invalid argument");
+      }
+    }
+    else if (argv[i] == "--trace"sv) {
+      if (argc - i - 1 < 1) return LogError("insufficient argument");
+      trace_file = argv[++i];
+    }
+    else if (argv[i] == "--jobs"sv) {
+      if (argc - i - 1 < 1) return LogError("insufficient argument");
+      if (!GetInteger(argv[++i], jobs) || !jobs) {
+        return LogError("invalid argument");
+      }
+    }
+    else if (argv[i] == "--base"sv) {
+      if (argc - i - 1 < 1) return LogError("insufficient argument");
+      base_file = argv[++i];
+    }
+    else if (argv[i] == "--flatten"sv) {
+      if (argc - i - 1 < 1) return LogError("insufficient argument");
+      flatten_file = argv[++i];
+    }
+    else if (argv[i] == "--in-memory"sv) {
+      in_memory = true;
+    }
+    else if (argv[i] == "--transfer"sv) {
+      if (argc - i - 1 < 1) return LogError("insufficient argument");
+      transfer_file = argv[++i];
+    }
+    else if (argv[i] == "--transfer-base"sv) {
+      if (argc - i - 1 < 1) return LogError("insufficient argument");
+      transfer_base = argv[++i];
+    }
+  }
+  if (trace_file) StartTrace();
+  if (queue_depth && jobs > 1) {
+    cerr << "io_uring device is not thread-safe, '--async' is ignored"
+         << endl;
+    queue_depth = 0;
+  }
+  if (base_file && hex_format) {
+    return LogError("overlay image must be raw binary");
+  }
+  if (base_file && in_memory) {
+    return LogError("overlay image can not be built in memory");
+  }
+  if (flatten_file && !base_file) {
+    return LogError("'--flatten' requires a base image");
+  }
+  if (transfer_base && !transfer_file) {
+    return LogError("'--transfer-base' requires '--transfer'");
+  }
+  if (queue_depth && base_file) {
+    cerr << "overlay image is not accessed through io_uring, "
+            "'--async' is ignored" << endl;
+    queue_depth = 0;
+  }
+
   // create GeeFS object
+  // hex images are built in memory and encoded when exiting
   auto fs = fstream();
-  auto dev = GetDeviceFromFile(fs, argv[1]);
+  auto mem_dev = MemDevice();
+  auto use_mem = hex_format || in_memory;
+  if (in_memory && !hex_format) {
+    if (auto ret = LoadImageFile(mem_dev, argv[1])) return ret;
+  }
+  unique_ptr<AsyncDevice> async_dev;
+  if (queue_depth && !use_mem) {
+    async_dev = NewURingDevice(argv[1], queue_depth, kAsyncBufferSize);
+    if (!async_dev) {
+      cerr << "io_uring is not available, fall back to synchronous I/O"
+           << endl;
+    }
+  }
+  // open overlay image, which shares unchanged chunks with base image
+  auto base_dev = FileDevice(), overlay_file = FileDevice();
+  optional<OverlayDevice> overlay_dev;
+  if (base_file) {
+    uint32_t chunk_size;
+    if (!GetBaseBlockSize(base_file, chunk_size) ||
+        !base_dev.Open(base_file)) {
+      return LogError("can not open base image");
+    }
+    if (!overlay_file.Open(argv[1])) return LogError("can not open image");
+    overlay_dev.emplace(base_dev, base_dev.size(), overlay_file,
+                        overlay_file.size(), chunk_size);
+    if (!overlay_dev->Open()) {
+      return LogError("image is not an overlay of base image");
+    }
+  }
+  // use positional I/O if there are multiple worker threads
+  auto file_dev = FileDevice();
+  optional<IOStreamDevice> stream_dev;
+  if (!use_mem && !async_dev && !overlay_dev) {
+    if (jobs > 1) {
+      if (!file_dev.Open(argv[1])) return LogError("can not open image");
+    }
+    else {
+      OpenImageFile(fs, argv[1]);
+      stream_dev.emplace(fs);
+    }
+  }
+  Device &dev = use_mem       ? static_cast<Device &>(mem_dev)
+                : async_dev   ? *async_dev
+                : overlay_dev ? static_cast<Device &>(*overlay_dev)
+                : stream_dev  ? static_cast<Device &>(*stream_dev)
+                              : file_dev;
   auto geefs = GeeFS(dev);
+  geefs.set_jobs(jobs);
 
   // read arguments
   bool imode = false, opened = false;
@@ -153,19 +469,73 @@ int main(int argc, const char *argv[]) {
           // add files
           ++i;
           while (i < argc && argv[i][0] != '-') {
-            auto file = GetFileName(argv[i]);
-            // create file
-            if (!geefs.CreateFile(file)) {
-              return LogError("can not create file in image");
-            }
             // create file stream
             ifstream ifs(argv[i]);
             auto size = GetStreamSize(ifs);
-            if (!ifs || !geefs.Write(file, ifs, 0, size)) {
-              return LogError("can not write file in image");
+            if (!ifs) return LogError("can not open file");
+            // add to image
+            if (!geefs.AddFile(GetFileName(argv[i]), ifs, size)) {
+              return LogError("can not add file to image");
             }
             ++i;
           }
+          if (!geefs.Flush()) return LogError("can not add file to image");
+          break;
+        }
+        case '-': {
+          if (argv[i] == "--format"sv || argv[i] == "--async"sv ||
+              argv[i] == "--trace"sv || argv[i] == "--jobs"sv ||
+              argv[i] == "--base"sv || argv[i] == "--flatten"sv ||
+              argv[i] == "--transfer"sv || argv[i] == "--transfer-base"sv) {
+            // already handled
+            ++i;
+          }
+          else if (argv[i] == "--in-memory"sv) {
+            // already handled
+          }
+          else if (argv[i] == "--index-dir"sv) {
+            uint32_t threshold;
+            if (argc - i - 1 < 1) return LogError("insufficient argument");
+            if (!GetInteger(argv[++i], threshold)) {
+              return LogError("invalid argument");
+            }
+            geefs.set_index_threshold(threshold);
+          }
+          else if (argv[i] == "--read-ahead"sv) {
+            uint32_t budget;
+            if (argc - i - 1 < 1) return LogError("insufficient argument");
+            if (!GetInteger(argv[++i], budget)) {
+              return LogError("invalid argument");
+            }
+            geefs.set_read_ahead_budget(budget * 1024);
+          }
+          else if (argv[i] == "--dedup"sv) {
+            geefs.set_dedup(true);
+          }
+          else if (argv[i] == "--inline-data"sv) {
+            geefs.set_inline_data(true);
+          }
+          else if (argv[i] == "--sparse"sv) {
+            geefs.set_sparse(true);
+          }
+          else if (argv[i] == "--preload"sv) {
+            geefs.set_preload(true);
+          }
+          else if (argv[i] == "--from-tar"sv) {
+            if (argc - i - 1 < 1) return LogError("insufficient argument");
+            // open image
+            if (!opened && !geefs.Open()) {
+              return LogError("can not open image");
+            }
+            opened = true;
+            // import archive
+            auto ret = argv[++i] == "-"sv ? ImportTar(geefs, cin)
+                                         : ImportTar(geefs, argv[i]);
+            if (ret) return ret;
+          }
+          else {
+            return LogError("unknown option");
+          }
           break;
         }
       }
@@ -175,7 +545,40 @@ int main(int argc, const char *argv[]) {
   // enter interactive mode
   if (imode) {
     if (!opened && !geefs.Open()) return LogError("can not open image");
-    return EnterIMode(geefs);
+    if (auto ret = EnterIMode(geefs, use_mem ? &mem_dev : nullptr)) {
+      return ret;
+    }
+  }
+
+  // write in-memory image, hex image, flattened image & transfer stream
+  if (in_memory && !hex_format) {
+    if (auto ret = SaveImageFile(geefs, mem_dev, argv[1])) return ret;
+  }
+  if (hex_format) {
+    if (auto ret = WriteHexFile(mem_dev, *hex_format, argv[1])) return ret;
+  }
+  if (flatten_file) {
+    if (auto ret = FlattenImage(geefs, *overlay_dev, flatten_file)) {
+      return ret;
+    }
+  }
+  if (transfer_file) {
+    if (auto ret = WriteTransferFile(geefs, dev, transfer_file,
+                                     transfer_base)) {
+      return ret;
+    }
   }
   return 0;
 }
+
+}  // namespace
+
+int main(int argc, const char *argv[]) {
+  // write trace after all worker threads are stopped, also on errors
+  const char *trace_file = nullptr;
+  auto ret = RunMkfs(argc, argv, trace_file);
+  if (trace_file) {
+    if (auto trace_ret = WriteTraceFile(trace_file); !ret) ret = trace_ret;
+  }
+  return ret;
+}
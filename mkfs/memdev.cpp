@@ -0,0 +1,163 @@
+#include "memdev.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// page that all unwritten pages are read as
+const std::array<std::uint8_t, kMemPageSize> kZeroPage = {};
+
+// check if all bytes of data are zero
+bool IsZeroData(const std::uint8_t *data, std::size_t len) {
+  return !len || (!data[0] && !std::memcmp(data, data + 1, len - 1));
+}
+
+}  // namespace
+
+std::int32_t MemDevice::Read(std::uint8_t *buf, std::size_t len,
+                             std::size_t offset) {
+  std::lock_guard<std::mutex> lock(lock_);
+  if (offset >= state_.size_) return -1;
+  auto size = std::min(state_.size_ - offset, len);
+  for (std::size_t i = 0; i < size;) {
+    auto index = (offset + i) / kMemPageSize;
+    auto inpg_ofs = (offset + i) % kMemPageSize;
+    auto count = std::min(kMemPageSize - inpg_ofs, size - i);
+    auto page = GetPage(index);
+    std::memcpy(buf + i, (page ? *page : kZeroPage).data() + inpg_ofs,
+                count);
+    i += count;
+  }
+  return size;
+}
+
+std::int32_t MemDevice::Write(const std::uint8_t *buf, std::size_t len,
+                              std::size_t offset) {
+  std::lock_guard<std::mutex> lock(lock_);
+  if (offset >= state_.size_) return -1;
+  auto size = std::min(state_.size_ - offset, len);
+  modified_ = true;
+  for (std::size_t i = 0; i < size;) {
+    auto index = (offset + i) / kMemPageSize;
+    auto inpg_ofs = (offset + i) % kMemPageSize;
+    auto count = std::min(kMemPageSize - inpg_ofs, size - i);
+    // writing zeros to unwritten page does not allocate it
+    if (GetPage(index) || !IsZeroData(buf + i, count)) {
+      std::memcpy(GetWritablePage(index).data() + inpg_ofs, buf + i, count);
+    }
+    i += count;
+  }
+  return size;
+}
+
+bool MemDevice::Sync() {
+  return true;
+}
+
+bool MemDevice::Resize(std::size_t size) {
+  std::lock_guard<std::mutex> lock(lock_);
+  // clear the tail of the last page when shrinking, so that it will be
+  // read as zeros after growing again
+  auto index = size / kMemPageSize, inpg_ofs = size % kMemPageSize;
+  if (size < state_.size_ && inpg_ofs && GetPage(index)) {
+    auto &page = GetWritablePage(index);
+    std::fill(page.begin() + inpg_ofs, page.end(), 0);
+  }
+  // drop pages beyond the new size in the last page table
+  auto page_num = (size + kMemPageSize - 1) / kMemPageSize;
+  auto table_num = (page_num + kMemPageTableSize - 1) / kMemPageTableSize;
+  auto first = page_num % kMemPageTableSize;
+  if (size < state_.size_ && first && state_.tables_[table_num - 1]) {
+    auto &table = state_.tables_[table_num - 1];
+    if (table.use_count() > 1) table = std::make_shared<PageTable>(*table);
+    std::fill(table->begin() + first, table->end(), nullptr);
+  }
+  state_.tables_.resize(table_num);
+  state_.size_ = size;
+  modified_ = true;
+  return true;
+}
+
+MemSnapshot MemDevice::Snapshot() {
+  std::lock_guard<std::mutex> lock(lock_);
+  return state_;
+}
+
+void MemDevice::Restore(const MemSnapshot &snapshot) {
+  std::lock_guard<std::mutex> lock(lock_);
+  state_ = snapshot;
+  modified_ = true;
+}
+
+bool MemDevice::Load(std::istream &is, std::size_t size) {
+  std::lock_guard<std::mutex> lock(lock_);
+  auto page_num = (size + kMemPageSize - 1) / kMemPageSize;
+  state_.tables_.clear();
+  state_.tables_.resize((page_num + kMemPageTableSize - 1) /
+                        kMemPageTableSize);
+  state_.size_ = size;
+  modified_ = false;
+  // read page by page, pages of zeros are not allocated
+  Page page = {};
+  for (std::size_t i = 0; i < page_num; ++i) {
+    auto count = std::min(kMemPageSize, size - i * kMemPageSize);
+    if (!is.read(reinterpret_cast<char *>(page.data()), count)) {
+      return false;
+    }
+    if (!IsZeroData(page.data(), count)) {
+      std::copy(page.begin(), page.begin() + count,
+                GetWritablePage(i).begin());
+    }
+  }
+  return true;
+}
+
+bool MemDevice::Save(std::ostream &os) {
+  std::lock_guard<std::mutex> lock(lock_);
+  auto page_num = (state_.size_ + kMemPageSize - 1) / kMemPageSize;
+  for (std::size_t i = 0; i < page_num; ++i) {
+    auto page = GetPage(i);
+    auto count = std::min(kMemPageSize, state_.size_ - i * kMemPageSize);
+    os.write(reinterpret_cast<const char *>((page ? *page : kZeroPage)
+                                                .data()),
+             count);
+  }
+  return !!os.flush();
+}
+
+std::size_t MemDevice::page_num() {
+  std::lock_guard<std::mutex> lock(lock_);
+  std::size_t num = 0;
+  for (const auto &table : state_.tables_) {
+    if (!table) continue;
+    num += std::count_if(table->begin(), table->end(),
+                         [](const auto &page) { return !!page; });
+  }
+  return num;
+}
+
+const MemDevice::Page *MemDevice::GetPage(std::size_t index) const {
+  const auto &table = state_.tables_[index / kMemPageTableSize];
+  return table ? (*table)[index % kMemPageTableSize].get() : nullptr;
+}
+
+MemDevice::Page &MemDevice::GetWritablePage(std::size_t index) {
+  // get page table, copy it if it is shared with snapshots
+  auto &table = state_.tables_[index / kMemPageTableSize];
+  if (!table) {
+    table = std::make_shared<PageTable>();
+  }
+  else if (table.use_count() > 1) {
+    table = std::make_shared<PageTable>(*table);
+  }
+  // get page, pages are zero-initialized
+  auto &page = (*table)[index % kMemPageTableSize];
+  if (!page) {
+    page = std::make_shared<Page>();
+  }
+  else if (page.use_count() > 1) {
+    page = std::make_shared<Page>(*page);
+  }
+  return *page;
+}
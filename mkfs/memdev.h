@@ -0,0 +1,78 @@
+#ifndef GEEOS_MKFS_MEMDEV_H_
+#define GEEOS_MKFS_MEMDEV_H_
+
+#include <istream>
+#include <ostream>
+#include <array>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <cstddef>
+#include <cstdint>
+
+#include "device.h"
+
+// size of memory page of 'MemDevice'
+constexpr std::size_t kMemPageSize = 4096;
+// number of pages in each page table of 'MemDevice'
+constexpr std::size_t kMemPageTableSize = 512;
+
+// saved state of 'MemDevice'
+class MemSnapshot {
+ private:
+  friend class MemDevice;
+  using Page = std::array<std::uint8_t, kMemPageSize>;
+  using PageTable = std::array<std::shared_ptr<Page>, kMemPageTableSize>;
+
+  // page tables shared with device, 'nullptr' if never written
+  std::vector<std::shared_ptr<PageTable>> tables_;
+  std::size_t size_ = 0;
+};
+
+// device backed by host memory, all operations are thread-safe
+// memory is allocated in pages when non-zero data is written to them,
+// pages and page tables are shared between device and its snapshots
+// until one of them is written (copy-on-write), so taking or restoring
+// a snapshot only copies a few pointers
+class MemDevice : public DeviceBase {
+ public:
+  MemDevice() {}
+
+  std::int32_t Read(std::uint8_t *buf, std::size_t len,
+                    std::size_t offset) override;
+  std::int32_t Write(const std::uint8_t *buf, std::size_t len,
+                     std::size_t offset) override;
+  bool Sync() override;
+  bool Resize(std::size_t size) override;
+
+  // take a snapshot of current content
+  MemSnapshot Snapshot();
+  // restore content from snapshot
+  void Restore(const MemSnapshot &snapshot);
+  // replace content with 'size' bytes read from stream
+  bool Load(std::istream &is, std::size_t size);
+  // write the whole content to stream sequentially
+  bool Save(std::ostream &os);
+
+  // size of device
+  std::size_t size() const { return state_.size_; }
+  // number of allocated pages, including pages shared with snapshots
+  std::size_t page_num();
+  // check if content may be changed since the last load
+  bool modified() const { return modified_; }
+
+ private:
+  using Page = MemSnapshot::Page;
+  using PageTable = MemSnapshot::PageTable;
+
+  // get page for reading, 'nullptr' if page is never written
+  const Page *GetPage(std::size_t index) const;
+  // get page for writing, allocate or copy it if necessary
+  Page &GetWritablePage(std::size_t index);
+
+  MemSnapshot state_;
+  bool modified_ = false;
+  std::mutex lock_;
+};
+
+#endif  // GEEOS_MKFS_MEMDEV_H_
@@ -0,0 +1,186 @@
+#include "overlaydev.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// size of buffer used when flattening overlay image
+constexpr std::size_t kFlattenBufferSize = 1024 * 1024;
+
+}  // namespace
+
+bool OverlayDevice::Open() {
+  std::lock_guard<std::mutex> lock(lock_);
+  chunks_.clear();
+  slots_.clear();
+  if (chunk_size_ < sizeof(OverlayHeader)) return false;
+  // empty overlay image, all chunks are in base image
+  if (!overlay_size_) {
+    size_ = base_size_;
+    return true;
+  }
+  // read & check header
+  OverlayHeader header;
+  if (!overlay_.ReadAssert(sizeof(header), header, 0)) return false;
+  if (header.magic != kOverlayMagic || header.chunk_size != chunk_size_ ||
+      header.base_size != base_size_) {
+    return false;
+  }
+  size_ = header.size;
+  // read remap table
+  chunks_.resize(header.chunk_num);
+  auto len = chunks_.size() * sizeof(std::uint32_t);
+  auto buf = reinterpret_cast<std::uint8_t *>(chunks_.data());
+  if (len && !overlay_.ReadAssert(len, buf, len,
+                                  SlotToOffset(chunks_.size()))) {
+    return false;
+  }
+  for (std::size_t i = 0; i < chunks_.size(); ++i) {
+    slots_[chunks_[i]] = i;
+  }
+  return true;
+}
+
+bool OverlayDevice::Flatten(DeviceBase &dev) {
+  std::lock_guard<std::mutex> lock(lock_);
+  std::vector<std::uint8_t> buf(kFlattenBufferSize);
+  for (std::size_t i = 0; i < size_; i += buf.size()) {
+    auto len = std::min(buf.size(), size_ - i);
+    if (!ReadImage(buf.data(), len, i) ||
+        !dev.WriteAssert(len, buf.data(), len, i)) {
+      return false;
+    }
+  }
+  return dev.Sync();
+}
+
+std::int32_t OverlayDevice::Read(std::uint8_t *buf, std::size_t len,
+                                 std::size_t offset) {
+  std::lock_guard<std::mutex> lock(lock_);
+  if (offset >= size_) return -1;
+  auto size = std::min(size_ - offset, len);
+  return ReadImage(buf, size, offset) ? size : -1;
+}
+
+std::int32_t OverlayDevice::Write(const std::uint8_t *buf, std::size_t len,
+                                  std::size_t offset) {
+  std::lock_guard<std::mutex> lock(lock_);
+  if (offset >= size_) return -1;
+  auto size = std::min(size_ - offset, len);
+  std::vector<std::uint8_t> chunk;
+  for (std::size_t i = 0; i < size;) {
+    auto index = (offset + i) / chunk_size_;
+    auto inchk_ofs = (offset + i) % chunk_size_;
+    auto count = std::min<std::size_t>(chunk_size_ - inchk_ofs, size - i);
+    auto it = slots_.find(index);
+    if (it != slots_.end()) {
+      // chunk has been copied, write to overlay image directly
+      auto ofs = SlotToOffset(it->second) + inchk_ofs;
+      if (!overlay_.WriteAssert(count, buf + i, count, ofs)) return -1;
+    }
+    else {
+      // copy chunk from base image if it is partially written
+      auto data = buf + i;
+      if (count != chunk_size_) {
+        chunk.resize(chunk_size_);
+        if (!ReadBase(chunk.data(), chunk_size_, index * chunk_size_)) {
+          return -1;
+        }
+        std::memcpy(chunk.data() + inchk_ofs, data, count);
+        data = chunk.data();
+      }
+      if (!AddChunk(index, data)) return -1;
+    }
+    i += count;
+  }
+  return size;
+}
+
+bool OverlayDevice::Sync() {
+  std::lock_guard<std::mutex> lock(lock_);
+  // drop unused space at the end of overlay image
+  auto table_ofs = SlotToOffset(chunks_.size());
+  auto table_len = chunks_.size() * sizeof(std::uint32_t);
+  if (!overlay_.Resize(table_ofs + table_len)) return false;
+  overlay_size_ = table_ofs + table_len;
+  // write header & remap table
+  OverlayHeader header = {kOverlayMagic, chunk_size_,
+                          static_cast<std::uint32_t>(chunks_.size()), 0,
+                          size_, base_size_};
+  auto buf = reinterpret_cast<const std::uint8_t *>(chunks_.data());
+  if (!overlay_.WriteAssert(sizeof(header), header, 0) ||
+      (table_len &&
+       !overlay_.WriteAssert(table_len, buf, table_len, table_ofs))) {
+    return false;
+  }
+  return overlay_.Sync();
+}
+
+bool OverlayDevice::Resize(std::size_t size) {
+  // stored chunks beyond the new size are kept, but never read
+  std::lock_guard<std::mutex> lock(lock_);
+  size_ = size;
+  return true;
+}
+
+bool OverlayDevice::ReadImage(std::uint8_t *buf, std::size_t len,
+                              std::size_t offset) {
+  for (std::size_t i = 0; i < len;) {
+    auto index = (offset + i) / chunk_size_;
+    auto inchk_ofs = (offset + i) % chunk_size_;
+    auto it = slots_.find(index);
+    // merge following chunks that are contiguous in the same image
+    auto count = chunk_size_ - inchk_ofs;
+    for (auto next = index + 1; i + count < len; ++next) {
+      auto next_it = slots_.find(next);
+      auto in_base = it == slots_.end();
+      if (in_base != (next_it == slots_.end()) ||
+          (!in_base && next_it->second != it->second + (next - index))) {
+        break;
+      }
+      count += chunk_size_;
+    }
+    count = std::min(count, len - i);
+    // read chunks
+    if (it == slots_.end()) {
+      if (!ReadBase(buf + i, count, offset + i)) return false;
+    }
+    else {
+      auto ofs = SlotToOffset(it->second) + inchk_ofs;
+      if (!overlay_.ReadAssert(count, buf + i, count, ofs)) return false;
+    }
+    i += count;
+  }
+  return true;
+}
+
+bool OverlayDevice::ReadBase(std::uint8_t *buf, std::size_t len,
+                             std::size_t offset) {
+  std::size_t count = 0;
+  if (offset < base_size_) {
+    count = std::min(base_size_ - offset, len);
+    if (!base_.ReadAssert(count, buf, count, offset)) return false;
+  }
+  std::memset(buf + count, 0, len - count);
+  return true;
+}
+
+bool OverlayDevice::AddChunk(std::size_t index,
+                             const std::uint8_t *data) {
+  auto slot = chunks_.size();
+  // grow overlay image exponentially
+  auto end = SlotToOffset(slot + 1);
+  if (end > overlay_size_) {
+    auto size = std::max<std::size_t>(end, overlay_size_ * 2);
+    if (!overlay_.Resize(size)) return false;
+    overlay_size_ = size;
+  }
+  if (!overlay_.WriteAssert(chunk_size_, data, chunk_size_,
+                            SlotToOffset(slot))) {
+    return false;
+  }
+  chunks_.push_back(index);
+  slots_[index] = slot;
+  return true;
+}
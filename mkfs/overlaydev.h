@@ -0,0 +1,87 @@
+#ifndef GEEOS_MKFS_OVERLAYDEV_H_
+#define GEEOS_MKFS_OVERLAYDEV_H_
+
+#include <unordered_map>
+#include <vector>
+#include <mutex>
+#include <cstddef>
+#include <cstdint>
+
+#include "device.h"
+
+// magic number of overlay images
+constexpr std::uint32_t kOverlayMagic = 0x9eef0e1a;
+
+// header of overlay image
+struct OverlayHeader {
+  std::uint32_t magic;          // magic number
+  std::uint32_t chunk_size;     // size of chunk
+  std::uint32_t chunk_num;      // number of chunks stored in overlay
+  std::uint32_t unused;         // reserved, always zero
+  std::uint64_t size;           // size of the whole image
+  std::uint64_t base_size;      // size of base image
+};
+
+// copy-on-write device that stores changed chunks in an overlay image,
+// reads of unchanged chunks fall through to a read-only base image
+//
+// layout of overlay image:
+//   chunk 0: header
+//   chunk 1..chunk_num: data of changed chunks
+//   after the last chunk: remap table, i-th entry is the index in image
+//                         of the i-th stored chunk
+// all operations are thread-safe
+class OverlayDevice : public DeviceBase {
+ public:
+  OverlayDevice(DeviceBase &base, std::size_t base_size, DeviceBase &overlay,
+                std::size_t overlay_size, std::uint32_t chunk_size)
+      : base_(base), base_size_(base_size), overlay_(overlay),
+        overlay_size_(overlay_size), chunk_size_(chunk_size),
+        size_(base_size) {}
+
+  // load remap table from overlay image, or initialize an empty one
+  // returns false if overlay image is invalid or does not match base
+  bool Open();
+  // write the whole image to device sequentially
+  // device must be resized to 'size()' in advance
+  bool Flatten(DeviceBase &dev);
+
+  std::int32_t Read(std::uint8_t *buf, std::size_t len,
+                    std::size_t offset) override;
+  std::int32_t Write(const std::uint8_t *buf, std::size_t len,
+                     std::size_t offset) override;
+  // write header & remap table to overlay image
+  bool Sync() override;
+  bool Resize(std::size_t size) override;
+
+  // size of image
+  std::size_t size() const { return size_; }
+  // number of chunks stored in overlay image
+  std::size_t chunk_num() const { return chunks_.size(); }
+
+ private:
+  // offset of the n-th stored chunk in overlay image
+  std::size_t SlotToOffset(std::size_t slot) const {
+    return (slot + 1) * chunk_size_;
+  }
+  // read from image, without locking
+  bool ReadImage(std::uint8_t *buf, std::size_t len, std::size_t offset);
+  // read from base image, parts beyond base image are read as zeros
+  bool ReadBase(std::uint8_t *buf, std::size_t len, std::size_t offset);
+  // store a new chunk to overlay image
+  bool AddChunk(std::size_t index, const std::uint8_t *data);
+
+  DeviceBase &base_;
+  std::size_t base_size_;
+  DeviceBase &overlay_;
+  std::size_t overlay_size_;
+  std::uint32_t chunk_size_;
+  std::size_t size_;
+  // chunk indices of all stored chunks, in the order of slots
+  std::vector<std::uint32_t> chunks_;
+  // chunk index in image -> slot in overlay image
+  std::unordered_map<std::uint32_t, std::size_t> slots_;
+  std::mutex lock_;
+};
+
+#endif  // GEEOS_MKFS_OVERLAYDEV_H_
@@ -0,0 +1,143 @@
+#include "readahead.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// window size when a sequential stream is detected
+constexpr std::size_t kInitWindow = 4;
+// max number of cached pointer blocks
+// enough for an indirect block plus both levels of 2nd indirect block
+constexpr std::size_t kMaxPointerBlocks = 4;
+
+}  // namespace
+
+std::pair<std::size_t, std::size_t> ReadAhead::Access(
+    std::uint32_t file_id, std::size_t n, std::size_t block_num) {
+  std::lock_guard<std::mutex> lock(lock_);
+  if (!max_window()) return {n, n};
+  // accessing the same block again does not break the stream
+  auto seq = file_id == file_id_ && (n == last_ + 1 || n == last_);
+  last_ = n;
+  if (!seq) {
+    // random access or restart of file, wait for the next sequential
+    // access, unless reading from the beginning
+    file_id_ = file_id;
+    window_ = 0;
+    ahead_ = n + 1;
+    if (n) return {n, n};
+  }
+  // start prefetching only when half of the window is consumed
+  ahead_ = std::max(ahead_, n + 1);
+  if (window_ && ahead_ - (n + 1) > window_ / 2) return {ahead_, ahead_};
+  // grow window
+  window_ = std::min(std::max(window_ * 2, kInitWindow), max_window());
+  auto first = ahead_;
+  ahead_ = std::max(first, std::min(n + 1 + window_, block_num));
+  return {first, ahead_};
+}
+
+void ReadAhead::Prefetch(const std::vector<std::uint32_t> &blks) {
+  std::lock_guard<std::mutex> lock(lock_);
+  std::vector<std::uint8_t> buf;
+  for (std::size_t i = 0; i < blks.size();) {
+    // skip blocks that are already cached
+    if (blocks_.count(blks[i])) {
+      ++i;
+      continue;
+    }
+    // find physically contiguous run
+    auto j = i + 1;
+    while (j < blks.size() && blks[j] == blks[j - 1] + 1 &&
+           !blocks_.count(blks[j])) {
+      ++j;
+    }
+    // read the whole run at once
+    auto len = (j - i) * block_size_;
+    buf.resize(len);
+    if (!dev_.ReadAssert(len, buf.data(), len,
+                         static_cast<std::size_t>(blks[i]) * block_size_)) {
+      return;
+    }
+    for (auto k = i; k < j; ++k) {
+      AddBlock(blks[k], buf.data() + (k - i) * block_size_);
+    }
+    i = j;
+  }
+}
+
+bool ReadAhead::Read(std::uint32_t blk_ofs, std::size_t inblk_ofs,
+                     std::uint8_t *buf, std::size_t len) {
+  std::lock_guard<std::mutex> lock(lock_);
+  auto it = blocks_.find(blk_ofs);
+  if (it == blocks_.end()) {
+    ++stats_.misses;
+    auto offset = static_cast<std::size_t>(blk_ofs) * block_size_;
+    return dev_.ReadAssert(len, buf, len, offset + inblk_ofs);
+  }
+  ++stats_.hits;
+  std::memcpy(buf, it->second.data() + inblk_ofs, len);
+  // drop the block if it has been read to the end
+  if (inblk_ofs + len == block_size_) RemoveBlock(blk_ofs);
+  return true;
+}
+
+bool ReadAhead::ReadPointer(std::uint32_t blk_ofs, std::size_t n,
+                            std::uint32_t &ptr) {
+  std::lock_guard<std::mutex> lock(lock_);
+  auto offset = static_cast<std::size_t>(blk_ofs) * block_size_;
+  if (!max_window()) {
+    return dev_.ReadAssert(sizeof(ptr), ptr, offset + n * sizeof(ptr));
+  }
+  auto it = ptr_blks_.find(blk_ofs);
+  if (it == ptr_blks_.end()) {
+    // evict the oldest pointer block
+    if (ptr_fifo_.size() == kMaxPointerBlocks) {
+      ptr_blks_.erase(ptr_fifo_.front());
+      ptr_fifo_.pop_front();
+    }
+    // read the whole pointer block
+    std::vector<std::uint32_t> ptrs(block_size_ / sizeof(ptr));
+    auto buf = reinterpret_cast<std::uint8_t *>(ptrs.data());
+    if (!dev_.ReadAssert(block_size_, buf, block_size_, offset)) {
+      return false;
+    }
+    it = ptr_blks_.insert({blk_ofs, std::move(ptrs)}).first;
+    ptr_fifo_.push_back(blk_ofs);
+  }
+  ptr = it->second[n];
+  return true;
+}
+
+void ReadAhead::Invalidate() {
+  std::lock_guard<std::mutex> lock(lock_);
+  Clear();
+}
+
+void ReadAhead::Clear() {
+  stats_.wasted += blocks_.size();
+  blocks_.clear();
+  fifo_.clear();
+  ptr_blks_.clear();
+  ptr_fifo_.clear();
+  file_id_ = 0;
+  last_ = ahead_ = window_ = 0;
+}
+
+void ReadAhead::AddBlock(std::uint32_t blk_ofs, const std::uint8_t *data) {
+  // evict the oldest blocks if exceeding the budget
+  while (!fifo_.empty() && (blocks_.size() + 1) * block_size_ > budget_) {
+    if (blocks_.erase(fifo_.front())) ++stats_.wasted;
+    fifo_.pop_front();
+  }
+  blocks_[blk_ofs].assign(data, data + block_size_);
+  fifo_.push_back(blk_ofs);
+  ++stats_.prefetched;
+}
+
+void ReadAhead::RemoveBlock(std::uint32_t blk_ofs) {
+  blocks_.erase(blk_ofs);
+  // drop offsets of used blocks at the front of queue
+  while (!fifo_.empty() && !blocks_.count(fifo_.front())) fifo_.pop_front();
+}
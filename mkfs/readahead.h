@@ -0,0 +1,97 @@
+#ifndef GEEOS_MKFS_READAHEAD_H_
+#define GEEOS_MKFS_READAHEAD_H_
+
+#include <unordered_map>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+
+#include "device.h"
+
+// default memory budget of read-ahead, in bytes
+constexpr std::size_t kDefaultReadAheadBudget = 256 * 1024;
+
+// counters of read-ahead
+struct ReadAheadStats {
+  std::size_t hits;         // block reads served by prefetched blocks
+  std::size_t misses;       // block reads that went to device
+  std::size_t prefetched;   // blocks read ahead
+  std::size_t wasted;       // prefetched blocks dropped before being used
+};
+
+// read-ahead engine of file data blocks
+// detects sequential access, prefetches the following blocks in batches
+// of physically contiguous runs, and caches recently used pointer blocks
+// all operations are thread-safe
+class ReadAhead {
+ public:
+  ReadAhead(Device &dev, std::uint32_t block_size)
+      : dev_(dev), block_size_(block_size),
+        budget_(kDefaultReadAheadBudget), stats_() {
+    Clear();
+  }
+
+  // record that the nth block of file has been read
+  // returns range [first, last) of blocks that should be prefetched
+  std::pair<std::size_t, std::size_t> Access(std::uint32_t file_id,
+                                             std::size_t n,
+                                             std::size_t block_num);
+  // prefetch blocks by block offsets
+  void Prefetch(const std::vector<std::uint32_t> &blks);
+  // read data in block, from prefetched block if possible
+  bool Read(std::uint32_t blk_ofs, std::size_t inblk_ofs,
+            std::uint8_t *buf, std::size_t len);
+  // read the nth block offset in pointer block
+  bool ReadPointer(std::uint32_t blk_ofs, std::size_t n,
+                   std::uint32_t &ptr);
+  // drop all cached blocks, must be called when blocks are modified
+  void Invalidate();
+
+  // set memory budget in bytes, 0 means disabling read-ahead
+  void set_budget(std::size_t budget) {
+    std::lock_guard<std::mutex> lock(lock_);
+    Clear();
+    budget_ = budget;
+  }
+  // get counters
+  ReadAheadStats stats() const {
+    std::lock_guard<std::mutex> lock(lock_);
+    return stats_;
+  }
+
+ private:
+  // max number of blocks in read-ahead window
+  std::size_t max_window() const { return budget_ / block_size_; }
+  // drop all cached blocks without locking
+  void Clear();
+  // put prefetched block to cache, evict the oldest block if necessary
+  void AddBlock(std::uint32_t blk_ofs, const std::uint8_t *data);
+  // remove used block from cache
+  void RemoveBlock(std::uint32_t blk_ofs);
+
+  // low-level device
+  Device &dev_;
+  // lock of all states
+  mutable std::mutex lock_;
+  // size of block
+  std::uint32_t block_size_;
+  // memory budget
+  std::size_t budget_;
+  // counters
+  ReadAheadStats stats_;
+  // state of current sequential stream
+  // file id, last accessed block, first block not prefetched, window size
+  std::uint32_t file_id_;
+  std::size_t last_, ahead_, window_;
+  // prefetched blocks, and their block offsets in prefetching order
+  std::unordered_map<std::uint32_t, std::vector<std::uint8_t>> blocks_;
+  std::deque<std::uint32_t> fifo_;
+  // recently used pointer blocks
+  std::unordered_map<std::uint32_t, std::vector<std::uint32_t>> ptr_blks_;
+  std::deque<std::uint32_t> ptr_fifo_;
+};
+
+#endif  // GEEOS_MKFS_READAHEAD_H_
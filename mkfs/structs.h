@@ -1,6 +1,7 @@
 #ifndef GEEOS_MKFS_STRUCTS_H_
 #define GEEOS_MKFS_STRUCTS_H_
 
+#include <cstddef>
 #include <cstdint>
 
 constexpr auto kMagicNum        = 0x9eef5000;
@@ -8,7 +9,18 @@ constexpr auto kDirectBlockNum  = 12;
 constexpr auto kBlockOfsSize    = sizeof(std::uint32_t);
 constexpr auto kFileNameMaxLen  = 28;
 
-enum class INodeType : std::uint32_t {
+// feature flags in super block
+constexpr std::uint32_t kFeatureIndexedDir  = 1 << 0;
+constexpr std::uint32_t kFeatureInlineData  = 1 << 1;
+constexpr std::uint32_t kFeatureHardLink    = 1 << 2;
+constexpr std::uint32_t kFeatureSparse      = 1 << 3;
+constexpr std::uint32_t kFeaturePreload     = 1 << 4;
+
+// flags of inode
+constexpr std::uint8_t kINodeFlagIndexed    = 1 << 0;
+constexpr std::uint8_t kINodeFlagInline     = 1 << 1;
+
+enum class INodeType : std::uint8_t {
   Unused = 0,
   File = 1,
   Dir = 2,
@@ -20,6 +32,8 @@ struct SuperBlockHeader {
   std::uint32_t block_size;                 // size of block
   std::uint32_t free_map_num;               // number of free map blocks
   std::uint32_t inode_blk_num;              // number of inode blocks
+  std::uint32_t features;                   // feature flags
+  std::uint32_t manifest;                   // preload manifest block id
 };
 
 struct FreeMapBlockHeader {
@@ -32,6 +46,8 @@ struct INodeBlockHeader {
 
 struct INode {
   INodeType     type;                       // type of inode
+  std::uint8_t  flags;                      // flags of inode
+  std::uint16_t link_count;                 // number of entries, 0 means 1
   std::uint32_t size;                       // size of file
   std::uint32_t block_num;                  // number of blocks
   std::uint32_t direct[kDirectBlockNum];    // direct blocks
@@ -39,9 +55,47 @@ struct INode {
   std::uint32_t indirect2;                  // 2nd indirect block id
 };
 
+// inline data of small files occupies 'direct', 'indirect' & 'indirect2'
+constexpr auto kInlineDataSize  = sizeof(std::uint32_t) *
+                                  (kDirectBlockNum + 2);
+static_assert(offsetof(INode, indirect2) + sizeof(std::uint32_t) -
+              offsetof(INode, direct) == kInlineDataSize);
+
 struct Entry {
   std::uint32_t inode_id;                   // inode id of file
   std::uint8_t  filename[kFileNameMaxLen];  // file name, ends with '\0'
 };
 
+// header of bucket block in indexed directory
+// occupies the first entry slot of the block
+struct BucketBlockHeader {
+  std::uint32_t next;                       // next block in bucket
+  std::uint32_t entry_num;                  // number of entries
+  std::uint8_t  reserved[sizeof(Entry) - 8];
+};
+
+// header of index block in indexed directory
+// followed by offsets of the first blocks in buckets
+struct IndexBlockHeader {
+  std::uint32_t bucket_num;                 // number of buckets
+};
+
+// header of preload manifest block, followed by entries
+struct PreloadHeader {
+  std::uint32_t entry_num;                  // number of entries
+};
+
+// entry of preload manifest, describes an executable whose data blocks
+// are stored contiguously
+// summary of program headers is not used by the kernel's ELF loader yet
+struct PreloadEntry {
+  std::uint32_t inode_id;                   // inode id of executable
+  std::uint32_t first_block;                // id of the first data block
+  std::uint32_t size;                       // size of file
+  std::uint32_t entry;                      // entry point
+  std::uint32_t phoff;                      // offset of program headers
+  std::uint16_t phnum;                      // number of program headers
+  std::uint16_t load_num;                   // number of loadable segments
+};
+
 #endif  // GEEOS_MKFS_STRUCTS_H_
@@ -0,0 +1,308 @@
+#include "tar.h"
+
+#include <algorithm>
+#include <limits>
+#include <cstring>
+#include <cstdint>
+
+namespace {
+
+// size of tar record
+constexpr std::size_t kTarBlockSize = 512;
+// max size of metadata payload (pax header, GNU long name)
+constexpr std::size_t kMaxMetadataSize = 64 * 1024;
+
+// POSIX ustar header
+struct TarHeader {
+  char name[100];
+  char mode[8];
+  char uid[8];
+  char gid[8];
+  char size[12];
+  char mtime[12];
+  char chksum[8];
+  char typeflag;
+  char linkname[100];
+  char magic[6];
+  char version[2];
+  char uname[32];
+  char gname[32];
+  char devmajor[8];
+  char devminor[8];
+  char prefix[155];
+  char padding[12];
+};
+
+static_assert(sizeof(TarHeader) == kTarBlockSize);
+
+// get string from a fixed-size field, which may not end with '\0'
+std::string_view GetField(const char *field, std::size_t len) {
+  return std::string_view(field, strnlen(field, len));
+}
+
+// parse numeric field, which may be octal or base-256
+bool ParseNumber(const char *field, std::size_t len, std::size_t &num) {
+  num = 0;
+  auto bytes = reinterpret_cast<const std::uint8_t *>(field);
+  if (bytes[0] & 0x80) {
+    // base-256 (GNU extension)
+    for (std::size_t i = 0; i < len; ++i) {
+      num = (num << 8) | (i ? bytes[i] : bytes[i] & 0x7f);
+    }
+    return true;
+  }
+  // octal, may be padded with spaces and '\0'
+  std::size_t i = 0;
+  while (i < len && field[i] == ' ') ++i;
+  if (i == len || field[i] < '0' || field[i] > '7') return false;
+  for (; i < len && field[i] >= '0' && field[i] <= '7'; ++i) {
+    num = (num << 3) | (field[i] - '0');
+  }
+  return i == len || field[i] == ' ' || field[i] == '\0';
+}
+
+// check if header is valid by checksum
+bool CheckHeader(const TarHeader &hdr) {
+  std::size_t chksum;
+  if (!ParseNumber(hdr.chksum, sizeof(hdr.chksum), chksum)) return false;
+  // checksum is calculated as if chksum field were filled with spaces
+  auto bytes = reinterpret_cast<const std::uint8_t *>(&hdr);
+  auto chk_ofs = static_cast<std::size_t>(
+      hdr.chksum - reinterpret_cast<const char *>(&hdr));
+  std::size_t sum = ' ' * sizeof(hdr.chksum);
+  std::size_t signed_sum = sum;
+  for (std::size_t i = 0; i < sizeof(hdr); ++i) {
+    if (i >= chk_ofs && i < chk_ofs + sizeof(hdr.chksum)) continue;
+    sum += bytes[i];
+    signed_sum += static_cast<std::int8_t>(bytes[i]);
+  }
+  // some old implementations use signed checksum
+  return chksum == sum || chksum == signed_sum;
+}
+
+// check if header is filled with zero (end of archive)
+bool IsZeroBlock(const TarHeader &hdr) {
+  auto bytes = reinterpret_cast<const std::uint8_t *>(&hdr);
+  return std::all_of(bytes, bytes + sizeof(hdr),
+                     [](std::uint8_t b) { return !b; });
+}
+
+// parse pax extended header records ("LEN KEY=VALUE\n")
+// returns false if records are malformed
+bool ParsePax(std::string_view data, std::string &path,
+              std::size_t &size, bool &has_size) {
+  while (!data.empty()) {
+    // get length of record
+    auto space = data.find(' ');
+    if (space == std::string_view::npos) return false;
+    std::size_t len = 0;
+    for (std::size_t i = 0; i < space; ++i) {
+      if (data[i] < '0' || data[i] > '9') return false;
+      len = len * 10 + (data[i] - '0');
+    }
+    if (len <= space + 1 || len > data.size() || data[len - 1] != '\n') {
+      return false;
+    }
+    // get key & value
+    auto record = data.substr(space + 1, len - space - 2);
+    auto eq = record.find('=');
+    if (eq == std::string_view::npos) return false;
+    auto key = record.substr(0, eq), value = record.substr(eq + 1);
+    if (key == "path") {
+      path = value;
+    }
+    else if (key == "size") {
+      size = 0;
+      for (const auto &c : value) {
+        if (c < '0' || c > '9') return false;
+        size = size * 10 + (c - '0');
+      }
+      has_size = true;
+    }
+    data.remove_prefix(len);
+  }
+  return true;
+}
+
+}  // namespace
+
+bool TarImporter::LogError(std::string_view msg, std::string_view path) {
+  error_ = msg;
+  if (!path.empty()) {
+    error_ += ": ";
+    error_ += path;
+  }
+  return false;
+}
+
+bool TarImporter::ReadMetadata(std::istream &is, std::size_t size,
+                               std::string &data) {
+  if (size > kMaxMetadataSize) return LogError("metadata entry too large");
+  data.resize(size);
+  is.read(data.data(), size);
+  if (is.gcount() != size) return LogError("unexpected end of archive");
+  // skip padding of metadata
+  return SkipPayload(is, (kTarBlockSize - size % kTarBlockSize) %
+                         kTarBlockSize);
+}
+
+bool TarImporter::SkipPayload(std::istream &is, std::size_t size) {
+  if (!size) return true;
+  is.ignore(size);
+  if (is.gcount() != size) return LogError("unexpected end of archive");
+  return true;
+}
+
+bool TarImporter::SplitPath(std::string_view path,
+                            std::vector<std::string> &names) {
+  names.clear();
+  while (!path.empty()) {
+    auto pos = path.find('/');
+    auto name = path.substr(0, pos);
+    if (name == "..") return false;
+    if (!name.empty() && name != ".") {
+      if (name.size() > kFileNameMaxLen - 1) return false;
+      names.push_back(std::string(name));
+    }
+    if (pos == std::string_view::npos) break;
+    path.remove_prefix(pos + 1);
+  }
+  return true;
+}
+
+bool TarImporter::EnterDir(const std::vector<std::string> &dirs) {
+  // find common prefix of cwd and target directory
+  std::size_t common = 0;
+  while (common < cur_dirs_.size() && common < dirs.size() &&
+         cur_dirs_[common] == dirs[common]) {
+    ++common;
+  }
+  // leave directories that are not in target path
+  while (cur_dirs_.size() > common) {
+    if (!geefs_.ChangeDir("..")) return false;
+    cur_dirs_.pop_back();
+  }
+  // enter target directories
+  for (auto i = common; i < dirs.size(); ++i) {
+    if (!geefs_.ChangeDir(dirs[i])) {
+      if (!geefs_.MakeDir(dirs[i]) || !geefs_.ChangeDir(dirs[i])) {
+        return false;
+      }
+    }
+    cur_dirs_.push_back(dirs[i]);
+  }
+  return true;
+}
+
+bool TarImporter::ImportFile(std::istream &is, std::string_view path,
+                             std::size_t size) {
+  // enter parent directory
+  std::vector<std::string> names;
+  if (!SplitPath(path, names) || names.empty()) {
+    return LogError("invalid file path", path);
+  }
+  auto file_name = names.back();
+  names.pop_back();
+  if (!EnterDir(names)) return LogError("can not create directory", path);
+  // stream payload to file
+  if (!geefs_.AddFile(file_name, is, size)) {
+    return LogError("can not add file to image", path);
+  }
+  // skip padding
+  return SkipPayload(is, (kTarBlockSize - size % kTarBlockSize) %
+                         kTarBlockSize);
+}
+
+bool TarImporter::Import(std::istream &is) {
+  TarHeader hdr;
+  std::string meta, long_name, pax_path;
+  std::size_t pax_size = 0;
+  bool has_pax_size = false;
+  cur_dirs_.clear();
+  error_.clear();
+  for (;;) {
+    // read header
+    is.read(reinterpret_cast<char *>(&hdr), sizeof(hdr));
+    if (is.gcount() != sizeof(hdr)) {
+      return LogError("unexpected end of archive");
+    }
+    if (IsZeroBlock(hdr)) break;
+    if (!CheckHeader(hdr)) return LogError("invalid tar header");
+    // get size of payload
+    std::size_t size;
+    if (!ParseNumber(hdr.size, sizeof(hdr.size), size)) {
+      return LogError("invalid tar header");
+    }
+    // handle metadata entries
+    if (hdr.typeflag == 'x' || hdr.typeflag == 'g' ||
+        hdr.typeflag == 'L') {
+      if (!ReadMetadata(is, size, meta)) return false;
+      if (hdr.typeflag == 'x') {
+        if (!ParsePax(meta, pax_path, pax_size, has_pax_size)) {
+          return LogError("invalid pax header");
+        }
+      }
+      else if (hdr.typeflag == 'L') {
+        long_name = GetField(meta.data(), meta.size());
+      }
+      continue;
+    }
+    // get path of entry
+    std::string path;
+    if (!pax_path.empty()) {
+      path = pax_path;
+    }
+    else if (!long_name.empty()) {
+      path = long_name;
+    }
+    else {
+      auto prefix = GetField(hdr.prefix, sizeof(hdr.prefix));
+      if (!prefix.empty() && !std::memcmp(hdr.magic, "ustar", 6)) {
+        path = prefix;
+        path += '/';
+      }
+      path += GetField(hdr.name, sizeof(hdr.name));
+    }
+    if (has_pax_size) size = pax_size;
+    // reset metadata of next entry
+    pax_path.clear();
+    long_name.clear();
+    has_pax_size = false;
+    // handle entry
+    switch (hdr.typeflag) {
+      case '\0': case '0': case '7': {
+        // regular file
+        if (!ImportFile(is, path, size)) return false;
+        break;
+      }
+      case '5': {
+        // directory
+        std::vector<std::string> names;
+        if (!SplitPath(path, names)) {
+          return LogError("invalid directory path", path);
+        }
+        if (!EnterDir(names)) {
+          return LogError("can not create directory", path);
+        }
+        // directories should have no payload, skip it with padding anyway
+        if (!SkipPayload(is, (size + kTarBlockSize - 1) /
+                             kTarBlockSize * kTarBlockSize)) {
+          return false;
+        }
+        break;
+      }
+      default: {
+        // links and special files are not supported by GeeFS, skip
+        if (!SkipPayload(is, (size + kTarBlockSize - 1) /
+                             kTarBlockSize * kTarBlockSize)) {
+          return false;
+        }
+        break;
+      }
+    }
+  }
+  // drain the rest of archive (end-of-archive padding)
+  is.ignore(std::numeric_limits<std::streamsize>::max());
+  // back to the import root
+  return EnterDir({}) || LogError("can not change directory");
+}
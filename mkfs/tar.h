@@ -0,0 +1,49 @@
+#ifndef GEEOS_MKFS_TAR_H_
+#define GEEOS_MKFS_TAR_H_
+
+#include <istream>
+#include <string_view>
+#include <string>
+#include <vector>
+#include <cstddef>
+
+#include "geefs.h"
+
+// import tar archive (ustar, pax and GNU long names) to GeeFS
+// archive is read sequentially in one pass, so it can be a pipe
+class TarImporter {
+ public:
+  TarImporter(GeeFS &geefs) : geefs_(geefs) {}
+
+  // import all entries in archive to cwd
+  bool Import(std::istream &is);
+
+  // get error message of last import
+  const std::string &error() const { return error_; }
+
+ private:
+  // log error message, always returns false
+  bool LogError(std::string_view msg, std::string_view path = {});
+  // read payload of metadata entry (pax header, GNU long name)
+  bool ReadMetadata(std::istream &is, std::size_t size,
+                    std::string &data);
+  // skip payload and padding of entry
+  bool SkipPayload(std::istream &is, std::size_t size);
+  // split path into components, returns false if path is invalid
+  bool SplitPath(std::string_view path, std::vector<std::string> &names);
+  // change cwd to specific directory relative to the import root
+  // creates missing directories on the way
+  bool EnterDir(const std::vector<std::string> &dirs);
+  // import a regular file
+  bool ImportFile(std::istream &is, std::string_view path,
+                  std::size_t size);
+
+  // GeeFS object
+  GeeFS &geefs_;
+  // cwd relative to the import root
+  std::vector<std::string> cur_dirs_;
+  // last error message
+  std::string error_;
+};
+
+#endif  // GEEOS_MKFS_TAR_H_
@@ -0,0 +1,63 @@
+#include "threadpool.h"
+
+namespace {
+
+// max number of pending jobs per thread
+// limits the memory used by jobs that hold their input data
+constexpr std::size_t kMaxPendingPerThread = 2;
+
+}  // namespace
+
+ThreadPool::ThreadPool(std::size_t thread_num)
+    : unfinished_(0), failed_(false), stopping_(false) {
+  for (std::size_t i = 0; i < thread_num; ++i) {
+    threads_.emplace_back([this] { Run(); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    stopping_ = true;
+  }
+  job_cond_.notify_all();
+  for (auto &&i : threads_) i.join();
+}
+
+void ThreadPool::Submit(std::function<bool()> job) {
+  std::unique_lock<std::mutex> lock(lock_);
+  done_cond_.wait(lock, [this] {
+    return jobs_.size() < kMaxPendingPerThread * threads_.size();
+  });
+  jobs_.push_back(std::move(job));
+  ++unfinished_;
+  lock.unlock();
+  job_cond_.notify_one();
+}
+
+bool ThreadPool::Wait() {
+  std::unique_lock<std::mutex> lock(lock_);
+  done_cond_.wait(lock, [this] { return !unfinished_; });
+  auto ret = !failed_;
+  failed_ = false;
+  return ret;
+}
+
+void ThreadPool::Run() {
+  for (;;) {
+    // get the next job
+    std::unique_lock<std::mutex> lock(lock_);
+    job_cond_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+    if (jobs_.empty()) return;
+    auto job = std::move(jobs_.front());
+    jobs_.pop_front();
+    lock.unlock();
+    // run the job
+    auto ret = job();
+    lock.lock();
+    if (!ret) failed_ = true;
+    --unfinished_;
+    lock.unlock();
+    done_cond_.notify_all();
+  }
+}
@@ -0,0 +1,44 @@
+#ifndef GEEOS_MKFS_THREADPOOL_H_
+#define GEEOS_MKFS_THREADPOOL_H_
+
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <cstddef>
+
+// fixed-size pool of worker threads
+class ThreadPool {
+ public:
+  explicit ThreadPool(std::size_t thread_num);
+  ~ThreadPool();
+
+  // submit a job, blocks if there are too many pending jobs
+  void Submit(std::function<bool()> job);
+  // wait for all submitted jobs to complete
+  // returns false if any job failed since last wait
+  bool Wait();
+
+  // number of worker threads
+  std::size_t thread_num() const { return threads_.size(); }
+
+ private:
+  // main loop of worker threads
+  void Run();
+
+  std::vector<std::thread> threads_;
+  std::mutex lock_;
+  // signaled when a job is submitted or pool is stopping
+  std::condition_variable job_cond_;
+  // signaled when a job is completed
+  std::condition_variable done_cond_;
+  // pending jobs
+  std::deque<std::function<bool()>> jobs_;
+  // number of submitted but not completed jobs
+  std::size_t unfinished_;
+  bool failed_, stopping_;
+};
+
+#endif  // GEEOS_MKFS_THREADPOOL_H_
@@ -0,0 +1,163 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cstring>
+
+std::atomic<bool> trace_enabled(false);
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// ring buffer of events, written by only one thread
+struct TraceBuffer {
+  std::uint32_t tid;
+  std::vector<TraceEvent> events;
+  std::atomic<std::size_t> count;
+};
+
+// all buffers, only locked when a thread records its first event
+std::mutex buffers_lock;
+std::vector<std::unique_ptr<TraceBuffer>> buffers;
+// time when tracing started
+Clock::time_point start_time;
+
+// buffer of current thread
+thread_local TraceBuffer *cur_buffer = nullptr;
+
+std::uint64_t GetTime() {
+  auto dur = Clock::now() - start_time;
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(dur).count();
+}
+
+TraceBuffer *GetBuffer() {
+  if (!cur_buffer) {
+    std::lock_guard<std::mutex> lock(buffers_lock);
+    auto buf = std::make_unique<TraceBuffer>();
+    buf->tid = buffers.size() + 1;
+    buf->events.resize(kTraceBufferSize);
+    buf->count = 0;
+    cur_buffer = buf.get();
+    buffers.push_back(std::move(buf));
+  }
+  return cur_buffer;
+}
+
+void WriteString(std::ostream &os, std::string_view str) {
+  os << '"';
+  for (const auto &c : str) {
+    switch (c) {
+      case '"': os << "\\\""; break;
+      case '\\': os << "\\\\"; break;
+      case '\n': os << "\\n"; break;
+      default: {
+        if (static_cast<unsigned char>(c) < 0x20) {
+          os << "\\u" << std::hex << std::setw(4) << std::setfill('0')
+             << static_cast<int>(c) << std::dec;
+        }
+        else {
+          os << c;
+        }
+        break;
+      }
+    }
+  }
+  os << '"';
+}
+
+// write time in microseconds
+void WriteTime(std::ostream &os, std::uint64_t ns) {
+  os << ns / 1000 << '.' << std::setw(3) << std::setfill('0') << ns % 1000;
+}
+
+void WriteEvent(std::ostream &os, const TraceEvent &event,
+                std::uint32_t tid) {
+  os << "{\"name\":";
+  WriteString(os, event.name);
+  os << ",\"cat\":\"geefs\",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid;
+  os << ",\"ts\":";
+  WriteTime(os, event.begin);
+  os << ",\"dur\":";
+  WriteTime(os, event.end - event.begin);
+  os << ",\"args\":{";
+  for (std::size_t i = 0; i < event.arg_num; ++i) {
+    const auto &arg = event.args[i];
+    if (i) os << ',';
+    WriteString(os, arg.key);
+    os << ':';
+    if (arg.is_str) {
+      WriteString(os, arg.str);
+    }
+    else {
+      os << arg.num;
+    }
+  }
+  os << "}}";
+}
+
+}  // namespace
+
+void StartTrace() {
+  start_time = Clock::now();
+  trace_enabled.store(true, std::memory_order_relaxed);
+}
+
+void StopTrace() {
+  trace_enabled.store(false, std::memory_order_relaxed);
+}
+
+bool WriteTrace(std::ostream &os) {
+  std::lock_guard<std::mutex> lock(buffers_lock);
+  os << "{\"traceEvents\":[";
+  bool first = true;
+  for (const auto &buf : buffers) {
+    // only the latest events are kept if buffer overflowed
+    auto count = buf->count.load(std::memory_order_acquire);
+    auto num = std::min(count, kTraceBufferSize);
+    for (auto i = count - num; i < count; ++i) {
+      os << (first ? "\n" : ",\n");
+      WriteEvent(os, buf->events[i % kTraceBufferSize], buf->tid);
+      first = false;
+    }
+  }
+  os << "\n],\"displayTimeUnit\":\"ns\"}" << std::endl;
+  return !!os;
+}
+
+void TraceSpan::Begin(const char *name) {
+  event_.name = name;
+  event_.arg_num = 0;
+  event_.begin = GetTime();
+}
+
+void TraceSpan::End() {
+  event_.end = GetTime();
+  // push to ring buffer of current thread
+  auto buf = GetBuffer();
+  auto count = buf->count.load(std::memory_order_relaxed);
+  buf->events[count % kTraceBufferSize] = event_;
+  buf->count.store(count + 1, std::memory_order_release);
+}
+
+void TraceSpan::AddNumArg(const char *key, std::int64_t num) {
+  if (event_.arg_num >= kMaxTraceArgs) return;
+  auto &arg = event_.args[event_.arg_num++];
+  arg.key = key;
+  arg.is_str = false;
+  arg.num = num;
+}
+
+void TraceSpan::AddStrArg(const char *key, std::string_view str) {
+  if (event_.arg_num >= kMaxTraceArgs) return;
+  auto &arg = event_.args[event_.arg_num++];
+  arg.key = key;
+  arg.is_str = true;
+  auto len = std::min(str.size(), kMaxTraceArgLen - 1);
+  std::memcpy(arg.str, str.data(), len);
+  arg.str[len] = '\0';
+}
@@ -0,0 +1,75 @@
+#ifndef GEEOS_MKFS_TRACE_H_
+#define GEEOS_MKFS_TRACE_H_
+
+#include <ostream>
+#include <string_view>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// max number of arguments of a trace event
+constexpr std::size_t kMaxTraceArgs = 3;
+// max length of string argument, longer strings will be truncated
+constexpr std::size_t kMaxTraceArgLen = 32;
+// number of events in ring buffer of each thread
+constexpr std::size_t kTraceBufferSize = 1 << 16;
+
+// argument of trace event
+struct TraceArg {
+  const char *key;
+  bool is_str;
+  std::int64_t num;
+  char str[kMaxTraceArgLen];
+};
+
+// complete event, which records a timed span
+struct TraceEvent {
+  const char *name;
+  std::uint64_t begin, end;     // nanoseconds since tracing started
+  std::size_t arg_num;
+  TraceArg args[kMaxTraceArgs];
+};
+
+// set if tracing is enabled
+extern std::atomic<bool> trace_enabled;
+
+// start recording trace events
+void StartTrace();
+// stop recording trace events
+void StopTrace();
+// write all recorded events to stream in Chrome trace event format
+// must be called after all traced threads have stopped recording
+bool WriteTrace(std::ostream &os);
+
+// RAII timed span, recorded when leaving scope
+// does nothing except checking a flag if tracing is disabled
+class TraceSpan {
+ public:
+  explicit TraceSpan(const char *name)
+      : enabled_(trace_enabled.load(std::memory_order_relaxed)) {
+    if (enabled_) Begin(name);
+  }
+  ~TraceSpan() {
+    if (enabled_) End();
+  }
+
+  // add an integer argument to event
+  void AddArg(const char *key, std::int64_t num) {
+    if (enabled_) AddNumArg(key, num);
+  }
+  // add a string argument to event
+  void AddArg(const char *key, std::string_view str) {
+    if (enabled_) AddStrArg(key, str);
+  }
+
+ private:
+  void Begin(const char *name);
+  void End();
+  void AddNumArg(const char *key, std::int64_t num);
+  void AddStrArg(const char *key, std::string_view str);
+
+  bool enabled_;
+  TraceEvent event_;
+};
+
+#endif  // GEEOS_MKFS_TRACE_H_
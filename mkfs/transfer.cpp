@@ -0,0 +1,101 @@
+#include "transfer.h"
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+#include <cstring>
+
+#include "structs.h"
+
+namespace {
+
+// size of buffer for reading from device
+constexpr std::size_t kReadBufSize = 64 * 1024;
+static_assert(kReadBufSize % kTransferBlockSize == 0);
+
+// get size of GeeFS image by its super block
+bool GetImageSize(Device &dev, std::size_t &size) {
+  SuperBlockHeader super_block;
+  if (!dev.ReadAssert(sizeof(super_block), super_block, 0) ||
+      super_block.magic_num != kMagicNum ||
+      super_block.block_size <= sizeof(FreeMapBlockHeader)) {
+    return false;
+  }
+  auto blk_per_fmb = (super_block.block_size - sizeof(FreeMapBlockHeader)) *
+                     8;
+  std::size_t blk_num = 1 + super_block.free_map_num;
+  blk_num += super_block.inode_blk_num;
+  blk_num += blk_per_fmb * super_block.free_map_num;
+  size = blk_num * super_block.block_size;
+  return true;
+}
+
+// check if all bytes of data are zero
+bool IsZeroData(const std::uint8_t *data, std::size_t len) {
+  return !len || (!data[0] && !std::memcmp(data, data + 1, len - 1));
+}
+
+}  // namespace
+
+bool WriteTransferStream(Device &dev, std::istream *base,
+                         std::size_t base_size, std::ostream &os,
+                         TransferStats &stats) {
+  std::size_t size;
+  if (!GetImageSize(dev, size) ||
+      size > std::numeric_limits<std::uint32_t>::max()) {
+    return false;
+  }
+  // bytes before 'clear' are compared with base image, others are
+  // compared with zeros
+  auto clear = base ? std::min(base_size, size) : 0;
+  stats = {size, 0, 0};
+  auto write = [&os, &stats](const void *data, std::size_t len) {
+    os.write(reinterpret_cast<const char *>(data), len);
+    stats.stream_size += len;
+  };
+  // write header
+  TransferHeader header = {kTransferMagic,
+                           static_cast<std::uint32_t>(size),
+                           static_cast<std::uint32_t>(clear)};
+  write(&header, sizeof(header));
+  // write runs of changed blocks, runs are split at buffer boundaries
+  std::vector<std::uint8_t> buf(kReadBufSize), base_buf(kReadBufSize);
+  for (std::size_t ofs = 0; ofs < size; ofs += buf.size()) {
+    // read data from device & base image
+    auto len = std::min(buf.size(), size - ofs);
+    if (!dev.ReadAssert(len, buf.data(), len, ofs)) return false;
+    auto base_len = ofs < clear ? std::min(len, clear - ofs) : 0;
+    if (base_len &&
+        !base->read(reinterpret_cast<char *>(base_buf.data()), base_len)) {
+      return false;
+    }
+    // find runs
+    std::size_t run_start = 0, run_len = 0;
+    for (std::size_t i = 0; i < len; i += kTransferBlockSize) {
+      auto count = std::min(kTransferBlockSize, len - i);
+      // block may straddle 'clear', compare its head with base image and
+      // check if its tail is zero
+      auto base_count = i < base_len ? std::min(count, base_len - i) : 0;
+      auto changed =
+          std::memcmp(buf.data() + i, base_buf.data() + i, base_count) ||
+          !IsZeroData(buf.data() + i + base_count, count - base_count);
+      if (changed) {
+        if (!run_len) run_start = i;
+        run_len += count;
+      }
+      if (run_len && (!changed || i + count == len)) {
+        // write the current run
+        TransferRunHeader run = {static_cast<std::uint32_t>(ofs + run_start),
+                                 static_cast<std::uint32_t>(run_len)};
+        write(&run, sizeof(run));
+        write(buf.data() + run_start, run_len);
+        ++stats.run_num;
+        run_len = 0;
+      }
+    }
+  }
+  // write the last run header
+  TransferRunHeader run = {static_cast<std::uint32_t>(size), 0};
+  write(&run, sizeof(run));
+  return !!os.flush();
+}
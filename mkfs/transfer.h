@@ -0,0 +1,49 @@
+#ifndef GEEOS_MKFS_TRANSFER_H_
+#define GEEOS_MKFS_TRANSFER_H_
+
+#include <istream>
+#include <ostream>
+#include <cstddef>
+#include <cstdint>
+
+#include "device.h"
+
+// magic number of compact transfer stream
+constexpr std::uint32_t kTransferMagic = 0x9e7a0001;
+// granularity of runs in compact transfer stream
+constexpr std::size_t kTransferBlockSize = 256;
+
+// header of compact transfer stream
+// followed by runs, each run is a run header and data, and the stream
+// ends with a run header whose length is zero
+//
+// receiver should clear [clear, size) of memory, then write runs to
+// memory, so bytes before 'clear' must have already been there (i.e. the
+// previous image that stream is generated against)
+struct TransferHeader {
+  std::uint32_t magic;      // magic number
+  std::uint32_t size;       // size of image
+  std::uint32_t clear;      // offset of the first byte that is cleared
+};
+
+// header of run in compact transfer stream
+struct TransferRunHeader {
+  std::uint32_t offset;     // offset of run in image
+  std::uint32_t len;        // length of run
+};
+
+// statistics of compact transfer stream
+struct TransferStats {
+  std::size_t image_size;   // size of the whole image
+  std::size_t stream_size;  // size of stream
+  std::size_t run_num;      // number of runs
+};
+
+// write GeeFS image on device to stream as a compact transfer stream,
+// which only contains blocks that are not zero, or blocks that differ
+// from the previous image if 'base' is not 'nullptr'
+bool WriteTransferStream(Device &dev, std::istream *base,
+                         std::size_t base_size, std::ostream &os,
+                         TransferStats &stats);
+
+#endif  // GEEOS_MKFS_TRANSFER_H_
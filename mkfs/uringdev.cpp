@@ -0,0 +1,239 @@
+#include "uringdev.h"
+
+#if __has_include(<linux/io_uring.h>)
+
+#include <algorithm>
+#include <string>
+#include <cstring>
+#include <cerrno>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+// number of queued requests that triggers a submission
+constexpr std::uint32_t kSubmitBatch = 8;
+
+int SetupURing(std::uint32_t entries, io_uring_params &params) {
+  return syscall(__NR_io_uring_setup, entries, &params);
+}
+
+int EnterURing(int fd, std::uint32_t to_submit, std::uint32_t min_complete,
+               std::uint32_t flags) {
+  return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                 nullptr, 0);
+}
+
+int RegisterURing(int fd, std::uint32_t opcode, const void *arg,
+                  std::uint32_t nr_args) {
+  return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+// get pointer to field of mapped ring
+template <typename T>
+T *GetField(void *ring, std::uint32_t offset) {
+  return reinterpret_cast<T *>(static_cast<std::uint8_t *>(ring) + offset);
+}
+
+}  // namespace
+
+URingDevice::URingDevice(std::uint32_t queue_depth,
+                         std::size_t buffer_size)
+    : fd_(-1), ring_fd_(-1), size_(0), queue_depth_(queue_depth),
+      buffer_size_(buffer_size), sq_ring_(MAP_FAILED),
+      cq_ring_(MAP_FAILED), sqes_(MAP_FAILED), to_submit_(0),
+      in_flight_(0), failed_(false) {
+  buffers_.resize(queue_depth * buffer_size);
+  expected_.resize(queue_depth);
+}
+
+URingDevice::~URingDevice() {
+  Wait();
+  if (sqes_ != MAP_FAILED) munmap(sqes_, sqes_size_);
+  if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_) {
+    munmap(cq_ring_, cq_ring_size_);
+  }
+  if (sq_ring_ != MAP_FAILED) munmap(sq_ring_, sq_ring_size_);
+  if (ring_fd_ >= 0) close(ring_fd_);
+  if (fd_ >= 0) close(fd_);
+}
+
+bool URingDevice::Init(std::string_view file_name) {
+  // open file
+  fd_ = open(std::string(file_name).c_str(), O_RDWR | O_CREAT, 0644);
+  struct stat st;
+  if (fd_ < 0 || fstat(fd_, &st) < 0) return false;
+  size_ = st.st_size;
+  // create io_uring
+  io_uring_params params;
+  std::memset(&params, 0, sizeof(params));
+  ring_fd_ = SetupURing(queue_depth_, params);
+  if (ring_fd_ < 0) return false;
+  // map submission/completion rings
+  sq_ring_size_ = params.sq_off.array +
+                  params.sq_entries * sizeof(std::uint32_t);
+  cq_ring_size_ = params.cq_off.cqes +
+                  params.cq_entries * sizeof(io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+  }
+  sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+  if (sq_ring_ == MAP_FAILED) return false;
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    cq_ring_ = sq_ring_;
+  }
+  else {
+    cq_ring_ = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+    if (cq_ring_ == MAP_FAILED) return false;
+  }
+  sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+  sqes_ = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+  if (sqes_ == MAP_FAILED) return false;
+  // get ring fields
+  sq_tail_ = GetField<std::uint32_t>(sq_ring_, params.sq_off.tail);
+  sq_mask_ = GetField<std::uint32_t>(sq_ring_, params.sq_off.ring_mask);
+  sq_array_ = GetField<std::uint32_t>(sq_ring_, params.sq_off.array);
+  cq_head_ = GetField<std::uint32_t>(cq_ring_, params.cq_off.head);
+  cq_tail_ = GetField<std::uint32_t>(cq_ring_, params.cq_off.tail);
+  cq_mask_ = GetField<std::uint32_t>(cq_ring_, params.cq_off.ring_mask);
+  cqes_ = GetField<void>(cq_ring_, params.cq_off.cqes);
+  // register buffers
+  std::vector<iovec> iovs(queue_depth_);
+  for (std::uint32_t i = 0; i < queue_depth_; ++i) {
+    iovs[i] = {buffer(i), buffer_size_};
+  }
+  return RegisterURing(ring_fd_, IORING_REGISTER_BUFFERS, iovs.data(),
+                       queue_depth_) >= 0;
+}
+
+bool URingDevice::Submit(std::uint8_t opcode, std::size_t buf_index,
+                         std::size_t len, std::size_t offset) {
+  if (buf_index >= queue_depth_ || len > buffer_size_) return false;
+  if (offset >= size_) return false;
+  len = std::min(size_ - offset, len);
+  // fill submission queue entry
+  auto tail = *sq_tail_;
+  auto index = tail & *sq_mask_;
+  auto sqe = static_cast<io_uring_sqe *>(sqes_) + index;
+  std::memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = opcode;
+  sqe->fd = fd_;
+  sqe->off = offset;
+  sqe->addr = reinterpret_cast<std::uint64_t>(buffer(buf_index));
+  sqe->len = len;
+  sqe->buf_index = buf_index;
+  sqe->user_data = buf_index;
+  sq_array_[index] = index;
+  expected_[buf_index] = len;
+  // make entry visible to kernel
+  __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+  ++to_submit_;
+  ++in_flight_;
+  // submit requests in batches
+  return to_submit_ < kSubmitBatch || Enter(0);
+}
+
+bool URingDevice::Enter(std::uint32_t min_complete) {
+  auto flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+  for (;;) {
+    auto ret = EnterURing(ring_fd_, to_submit_, min_complete, flags);
+    if (ret >= 0) {
+      to_submit_ -= std::min<std::uint32_t>(ret, to_submit_);
+      if (!to_submit_ || min_complete) return true;
+    }
+    else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+      return false;
+    }
+    // reap completions to make room for submissions
+    Reap();
+  }
+}
+
+void URingDevice::Reap() {
+  auto head = *cq_head_;
+  auto tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+  for (; head != tail; ++head) {
+    auto cqe = static_cast<io_uring_cqe *>(cqes_) + (head & *cq_mask_);
+    if (cqe->res != expected_[cqe->user_data]) failed_ = true;
+    --in_flight_;
+  }
+  __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+}
+
+bool URingDevice::SubmitRead(std::size_t buf_index, std::size_t len,
+                             std::size_t offset) {
+  return Submit(IORING_OP_READ_FIXED, buf_index, len, offset);
+}
+
+bool URingDevice::SubmitWrite(std::size_t buf_index, std::size_t len,
+                              std::size_t offset) {
+  return Submit(IORING_OP_WRITE_FIXED, buf_index, len, offset);
+}
+
+bool URingDevice::Wait() {
+  if (ring_fd_ < 0) return true;
+  while (in_flight_) {
+    if (!Enter(in_flight_)) return false;
+    Reap();
+  }
+  auto ret = !failed_;
+  failed_ = false;
+  return ret;
+}
+
+std::int32_t URingDevice::Read(std::uint8_t *buf, std::size_t len,
+                               std::size_t offset) {
+  if (offset >= size_) return -1;
+  auto size = std::min(size_ - offset, len);
+  auto ret = pread(fd_, buf, size, offset);
+  return static_cast<std::size_t>(ret) == size ? size : -1;
+}
+
+std::int32_t URingDevice::Write(const std::uint8_t *buf, std::size_t len,
+                                std::size_t offset) {
+  if (offset >= size_) return -1;
+  auto size = std::min(size_ - offset, len);
+  auto ret = pwrite(fd_, buf, size, offset);
+  return static_cast<std::size_t>(ret) == size ? size : -1;
+}
+
+bool URingDevice::Sync() {
+  // like 'IOStreamDevice', only makes sure all writes are issued
+  return Wait();
+}
+
+bool URingDevice::Resize(std::size_t size) {
+  if (!Wait() || ftruncate(fd_, size) < 0) return false;
+  size_ = size;
+  return true;
+}
+
+std::unique_ptr<AsyncDevice> NewURingDevice(std::string_view file_name,
+                                            std::uint32_t queue_depth,
+                                            std::size_t buffer_size) {
+  if (!queue_depth || !buffer_size) return nullptr;
+  auto dev = std::unique_ptr<URingDevice>(
+      new URingDevice(queue_depth, buffer_size));
+  if (!dev->Init(file_name)) return nullptr;
+  return dev;
+}
+
+#else  // __has_include(<linux/io_uring.h>)
+
+std::unique_ptr<AsyncDevice> NewURingDevice(std::string_view file_name,
+                                            std::uint32_t queue_depth,
+                                            std::size_t buffer_size) {
+  // io_uring is not available on current platform
+  return nullptr;
+}
+
+#endif  // __has_include(<linux/io_uring.h>)
@@ -0,0 +1,84 @@
+#ifndef GEEOS_MKFS_URINGDEV_H_
+#define GEEOS_MKFS_URINGDEV_H_
+
+#include <string_view>
+#include <memory>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "device.h"
+
+// asynchronous file device based on Linux io_uring
+class URingDevice : public AsyncDevice {
+ public:
+  ~URingDevice();
+
+  std::int32_t Read(std::uint8_t *buf, std::size_t len,
+                    std::size_t offset) override;
+  std::int32_t Write(const std::uint8_t *buf, std::size_t len,
+                     std::size_t offset) override;
+  bool Sync() override;
+  bool Resize(std::size_t size) override;
+
+  bool SubmitRead(std::size_t buf_index, std::size_t len,
+                  std::size_t offset) override;
+  bool SubmitWrite(std::size_t buf_index, std::size_t len,
+                   std::size_t offset) override;
+  bool Wait() override;
+
+  std::uint8_t *buffer(std::size_t buf_index) override {
+    return buffers_.data() + buf_index * buffer_size_;
+  }
+  std::size_t queue_depth() const override { return queue_depth_; }
+  std::size_t buffer_size() const override { return buffer_size_; }
+
+ private:
+  friend std::unique_ptr<AsyncDevice> NewURingDevice(
+      std::string_view, std::uint32_t, std::size_t);
+
+  URingDevice(std::uint32_t queue_depth, std::size_t buffer_size);
+
+  // open file and initialize io_uring
+  bool Init(std::string_view file_name);
+  // push a request to submission queue
+  bool Submit(std::uint8_t opcode, std::size_t buf_index, std::size_t len,
+              std::size_t offset);
+  // submit all queued requests, and wait for 'min_complete' requests
+  bool Enter(std::uint32_t min_complete);
+  // consume all completion events
+  void Reap();
+
+  // file & io_uring descriptor
+  int fd_, ring_fd_;
+  // size of file
+  std::size_t size_;
+  // queue depth & size of each registered buffer
+  std::uint32_t queue_depth_;
+  std::size_t buffer_size_;
+  // registered buffers
+  std::vector<std::uint8_t> buffers_;
+  // mapped rings
+  void *sq_ring_, *cq_ring_, *sqes_;
+  std::size_t sq_ring_size_, cq_ring_size_, sqes_size_;
+  // pointers to ring fields
+  std::uint32_t *sq_tail_, *sq_mask_, *sq_array_;
+  std::uint32_t *cq_head_, *cq_tail_, *cq_mask_;
+  void *cqes_;
+  // number of queued but not submitted requests
+  std::uint32_t to_submit_;
+  // number of submitted but not completed requests
+  std::uint32_t in_flight_;
+  // expected result of each request, indexed by buffer
+  std::vector<std::int32_t> expected_;
+  // set if any request failed since last wait
+  bool failed_;
+};
+
+// create a new io_uring device on file
+// returns 'nullptr' if io_uring is not available
+std::unique_ptr<AsyncDevice> NewURingDevice(std::string_view file_name,
+                                            std::uint32_t queue_depth,
+                                            std::size_t buffer_size);
+
+#endif  // GEEOS_MKFS_URINGDEV_H_
@@ -0,0 +1,67 @@
+#!/usr/local/bin/python3
+
+# compare synchronous, io_uring and in-memory device backends of mkfs
+# by building and extracting large images
+# by MaxXing
+
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+
+def run(args, stdin=None):
+  start = time.perf_counter()
+  subprocess.run(args, stdin=stdin, stdout=subprocess.DEVNULL, check=True)
+  return time.perf_counter() - start
+
+
+def bench(mkfs, image, files, blk_size, async_args):
+  # create image, then read all files back
+  # use just enough free map blocks for all files
+  data_blks = sum(os.path.getsize(f) for f in files) // blk_size
+  free_map_num = data_blks * 9 // 8 // ((blk_size - 4) * 8) + 1
+  create = run([mkfs, image] + async_args +
+               ['-c', str(blk_size), str(free_map_num), '4', '-a'] + files)
+  cmds = ''.join(f'read {os.path.basename(f)}\n' for f in files)
+  with tempfile.TemporaryFile() as f:
+    f.write(f'{cmds}quit\n'.encode())
+    f.seek(0)
+    read = run([mkfs, image] + async_args + ['-i'], stdin=f)
+  return create, read
+
+
+if __name__ == '__main__':
+  if len(sys.argv) < 2:
+    print('usage: ./benchdev.py MKFS [FILE_MB] [QUEUE_DEPTH] [ROUNDS]')
+    exit(1)
+
+  mkfs = sys.argv[1]
+  file_mb = int(sys.argv[2]) if len(sys.argv) > 2 else 16
+  queue_depth = sys.argv[3] if len(sys.argv) > 3 else '64'
+  rounds = int(sys.argv[4]) if len(sys.argv) > 4 else 3
+
+  with tempfile.TemporaryDirectory() as tmp:
+    # generate test files
+    files = []
+    for i in range(4):
+      file = os.path.join(tmp, f'file{i}.bin')
+      with open(file, 'wb') as f:
+        f.write(os.urandom(file_mb * 1024 * 1024 // 4))
+      files.append(file)
+    image = os.path.join(tmp, 'bench.img')
+    # run benchmarks
+    print('backend    blk_size   create(s)  read(s)')
+    for blk_size in [512, 4096]:
+      backends = [('sync', []), ('io_uring', ['--async', queue_depth]),
+                  ('memory', ['--in-memory'])]
+      for name, args in backends:
+        results = []
+        for _ in range(rounds):
+          if os.path.exists(image):
+            os.remove(image)
+          results.append(bench(mkfs, image, files, blk_size, args))
+        create = min(r[0] for r in results)
+        read = min(r[1] for r in results)
+        print(f'{name:<10} {blk_size:<10} {create:<10.3f} {read:.3f}')
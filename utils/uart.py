@@ -4,14 +4,19 @@
 # designed for Fuxi SoC
 # by MaxXing
 
-import serial
-from serial.tools.list_ports import comports
-
-import os
 import sys
 
 baudrate = 115200
 
+# magic number of compact transfer stream, same as 'mkfs --transfer'
+transfer_magic = 0x9e7a0001
+# size of header of compact transfer stream
+transfer_header_size = 12
+# granularity of runs in compact transfer stream
+transfer_block_size = 256
+# message printed by receiver when it is ready to receive runs
+transfer_ready = b'receiving runs'
+
 
 def get_word(num):
   byte_list = []
@@ -21,24 +26,89 @@ def get_word(num):
   return bytes(byte_list)
 
 
-def make_packet(file_name, offset, slice_len=1):
-  packet = []
+def read_file(file_name):
   with open(file_name, 'rb') as f:
-    size = os.path.getsize(file_name)
-    packet.append(get_word(0x9e9e9e9e))
-    packet.append(get_word(offset))
-    packet.append(get_word(size))
-    for _ in range(0, size, slice_len):
-      packet.append(f.read(slice_len))
+    return f.read()
+
+
+# encode any data as compact transfer stream, only blocks that are not zero
+# (or that differ from 'base' if it is not 'None') are sent
+def make_transfer_stream(data, base=None):
+  # all bytes are compared with zero if there is no base
+  base = base if base is not None else b''
+  size = len(data)
+  clear = min(len(base), size)
+
+  def changed(i):
+    # compare bytes before 'clear' with base, and check others are zero
+    end = min(i + transfer_block_size, size)
+    mid = max(i, min(end, clear))
+    return data[i:mid] != base[i:mid] or data[mid:end].count(0) != end - mid
+
+  stream = [get_word(transfer_magic), get_word(size), get_word(clear)]
+  start = None
+  for i in range(0, size + transfer_block_size, transfer_block_size):
+    if i < size and changed(i):
+      if start is None:
+        start = i
+    elif start is not None:
+      # write the current run
+      end = min(i, size)
+      stream += [get_word(start), get_word(end - start), data[start:end]]
+      start = None
+  stream += [get_word(size), get_word(0)]
+  return b''.join(stream)
+
+
+# 'None' in packet means waiting until receiver is ready
+def make_packet(file_name, offset, slice_len=1, compact=False,
+                base_name=None):
+  packet = []
+  data = read_file(file_name)
+  is_stream = data[:4] == get_word(transfer_magic)
+  if not is_stream and (compact or base_name):
+    base = read_file(base_name) if base_name else None
+    data = make_transfer_stream(data, base)
+    is_stream = True
+  packet.append(get_word(0x9e9e9e9e))
+  packet.append(get_word(offset))
+  if is_stream:
+    # receiver clears memory after reading header of stream
+    packet.append(get_word(0xffffffff))
+    packet.append(data[:transfer_header_size])
+    packet.append(None)
+    data = data[transfer_header_size:]
+  else:
+    packet.append(get_word(len(data)))
+  for i in range(0, len(data), slice_len):
+    packet.append(data[i:i + slice_len])
   return packet
 
 
+# 'received' is the output of receiver that has already been read
+def wait_ready(ser, received, timeout=60):
+  from time import time
+  start = time()
+  while transfer_ready not in received:
+    if time() - start > timeout:
+      raise TimeoutError('receiver is not ready')
+    data = ser.read(max(ser.in_waiting, 1))
+    print(data.decode('utf-8', errors='replace'), end='')
+    received += data
+
+
 def send_uart(ser, packet):
+  received = b''
   for i, p in enumerate(packet):
+    if p is None:
+      wait_ready(ser, received)
+      continue
     ser.write(p)
     print('sending {:.2%}...\r'.format(i / len(packet)), end='')
     if ser.in_waiting:
-      print(ser.read(ser.in_waiting).decode('utf-8', errors='replace'), end='')
+      data = ser.read(ser.in_waiting)
+      print(data.decode('utf-8', errors='replace'), end='')
+      received += data
   print()
 
 
@@ -99,12 +169,21 @@ def read_uart(ser):
 
 
 if __name__ == '__main__':
+  import serial
+  from serial.tools.list_ports import comports
+
   args = sys.argv
   args.pop(0)
 
   if len(args) < 1:
     print('usage: ./uart.py DEVICE')
-    print('   or: ./uart.py DEVICE FILE OFFSET')
+    print('   or: ./uart.py DEVICE FILE OFFSET [--compact] [--base PREV]')
+    print('FILE is booted as an ELF file, it can also be a compact transfer')
+    print('stream of an ELF file')
+    print('  --compact  send FILE as a compact transfer stream, which only')
+    print('             contains blocks that are not zero')
+    print('  --base     only send blocks that differ from file PREV, which')
+    print('             must have been in memory at OFFSET')
     print('avaliable devices:')
     for i in comports():
       print(f'  {i.device}')
@@ -115,6 +194,8 @@ if __name__ == '__main__':
   else:
     print(f'sending via {args[0]}...')
     ser = serial.Serial(args[0], baudrate, timeout=1)
-    packet = make_packet(args[1], int(eval(args[2])))
+    compact = '--compact' in args
+    base = args[args.index('--base') + 1] if '--base' in args else None
+    packet = make_packet(args[1], int(eval(args[2])), 1, compact, base)
     send_uart(ser, packet)
     read_uart(ser)
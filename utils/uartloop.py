@@ -0,0 +1,192 @@
+#!/usr/local/bin/python3
+
+# send kernel ELF files that embed GeeFS images (raw or as compact transfer
+# streams) through a pseudo terminal pair, receive them by a model of the
+# bootloader's UART boot path, and compare the bytes sent
+# by MaxXing
+
+import contextlib
+import fcntl
+import os
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+import termios
+import threading
+import tty
+
+import uart
+
+
+class Loopback:
+  '''serial port like object on master side of pseudo terminal'''
+
+  def __init__(self, fd):
+    self.fd = fd
+    self.sent = 0
+
+  @property
+  def in_waiting(self):
+    buf = fcntl.ioctl(self.fd, termios.FIONREAD, b'\0\0\0\0')
+    return struct.unpack('I', buf)[0]
+
+  def read(self, size=1):
+    return os.read(self.fd, size)
+
+  def write(self, data):
+    self.sent += len(data)
+    while data:
+      data = data[os.write(self.fd, data):]
+
+
+class Receiver(threading.Thread):
+  '''model of 'receiveFromUart' in 'src/boot/uart.yu', and the ELF check
+  of 'loadElf' in 'src/boot/entry.yu' if 'boot' is set'''
+
+  def __init__(self, fd, ram, boot):
+    super().__init__()
+    self.fd = fd
+    self.ram = ram
+    self.boot = boot
+    self.buf = bytearray()
+    self.error = None
+
+  def read(self, size):
+    while len(self.buf) < size:
+      self.buf += os.read(self.fd, 65536)
+    data = bytes(self.buf[:size])
+    del self.buf[:size]
+    return data
+
+  def read_word(self):
+    return struct.unpack('<I', self.read(4))[0]
+
+  def print(self, msg):
+    os.write(self.fd, msg.encode())
+
+  def receive_runs(self, offset):
+    magic, size, clear = struct.unpack('<III', self.read(12))
+    if magic != uart.transfer_magic or clear > size:
+      raise ValueError('invalid transfer stream')
+    self.ram[offset + clear:offset + size] = bytes(size - clear)
+    self.print('receiving runs...\n')
+    while True:
+      run_ofs, run_len = struct.unpack('<II', self.read(8))
+      if not run_len:
+        break
+      if run_ofs + run_len > size:
+        raise ValueError('run is out of range')
+      start = offset + run_ofs
+      self.ram[start:start + run_len] = self.read(run_len)
+
+  def run(self):
+    try:
+      while self.read(4) != bytes([0x9e] * 4):
+        pass
+      offset, size = self.read_word(), self.read_word()
+      if size == 0xffffffff:
+        self.receive_runs(offset)
+      else:
+        self.ram[offset:offset + size] = self.read(size)
+      self.print('done receiving data\n')
+      if self.boot and self.ram[offset:offset + 4] != b'\x7fELF':
+        raise ValueError('invalid ELF file')
+    except Exception as e:
+      self.error = e
+
+
+def send(file_name, ram, boot, compact=False, base_name=None):
+  # open pseudo terminal pair in raw mode
+  master, slave = os.openpty()
+  tty.setraw(master)
+  tty.setraw(slave)
+  receiver = Receiver(slave, ram, boot)
+  receiver.start()
+  ser = Loopback(master)
+  packet = uart.make_packet(file_name, 0, 4096, compact, base_name)
+  try:
+    with open(os.devnull, 'w') as null, contextlib.redirect_stdout(null):
+      uart.send_uart(ser, packet)
+    receiver.join()
+  finally:
+    os.close(master)
+    os.close(slave)
+  if receiver.error:
+    raise receiver.error
+  return ser.sent
+
+
+def run_mkfs(mkfs, args):
+  subprocess.run([mkfs] + args, stdout=subprocess.DEVNULL, check=True)
+
+
+# write a minimal RISC-V kernel ELF file, whose only segment contains some
+# code and the GeeFS image, like 'src/init.S' does with '.incbin'
+def make_kernel(file_name, code, image):
+  addr, ofs = 0x80000000, 0x1000
+  data = code + image
+  ehdr = struct.pack('<4sBBBB8xHHIIIIIHHHHHH', b'\x7fELF', 1, 1, 1, 0, 2,
+                     0xf3, 1, addr, 52, 0, 0, 52, 32, 1, 40, 0, 0)
+  phdr = struct.pack('<IIIIIIII', 1, ofs, addr, addr, len(data), len(data),
+                     5, ofs)
+  with open(file_name, 'wb') as f:
+    f.write((ehdr + phdr).ljust(ofs, b'\0') + data)
+
+
+if __name__ == '__main__':
+  if len(sys.argv) < 2:
+    print('usage: ./uartloop.py MKFS [FILE ...]')
+    exit(1)
+
+  mkfs = sys.argv[1]
+  with tempfile.TemporaryDirectory() as tmp:
+    # generate test files if not provided
+    files = sys.argv[2:]
+    if not files:
+      contents = [os.urandom(200 * 1024), b'hello geefs\n' * 1000,
+                  os.urandom(4096) + bytes(64 * 1024) + os.urandom(4096)]
+      for i, data in enumerate(contents):
+        files.append(os.path.join(tmp, f'file{i}.bin'))
+        with open(files[-1], 'wb') as f:
+          f.write(data)
+    extra = os.path.join(tmp, 'extra.bin')
+    with open(extra, 'wb') as f:
+      f.write(os.urandom(3000))
+    # build image, then add a file to its copy
+    old_img, old_tx = [os.path.join(tmp, f'old.{e}') for e in ['img', 'tx']]
+    new_img, new_tx = [os.path.join(tmp, f'new.{e}') for e in ['img', 'tx']]
+    run_mkfs(mkfs, [old_img, '-c', '512', '4', '4', '-a'] + files +
+             ['--transfer', old_tx])
+    shutil.copyfile(old_img, new_img)
+    run_mkfs(mkfs, [new_img, '-a', extra, '--transfer', new_tx,
+                    '--transfer-base', old_img])
+    # build kernels that embed images
+    code = os.urandom(64 * 1024)
+    old_elf, new_elf = [os.path.join(tmp, f'{n}.elf') for n in ['old', 'new']]
+    make_kernel(old_elf, code, uart.read_file(old_img))
+    make_kernel(new_elf, code, uart.read_file(new_img))
+    old, new = uart.read_file(old_elf), uart.read_file(new_elf)
+    old_raw, new_raw = uart.read_file(old_img), uart.read_file(new_img)
+    # send kernels through boot path, and streams generated by mkfs to
+    # check that they decode to images, RAM initially contains garbage or
+    # the previous file
+    cases = [('raw', old_elf, True, {}, os.urandom(len(old)), old),
+             ('compact', old_elf, True, {'compact': True},
+              os.urandom(len(old)), old),
+             ('raw update', new_elf, True, {}, old, new),
+             ('delta', new_elf, True, {'base_name': old_elf}, old, new),
+             ('mkfs image', old_tx, False, {}, os.urandom(len(old_raw)),
+              old_raw),
+             ('mkfs delta', new_tx, False, {}, old_raw, new_raw)]
+    print('case         sent(B)     ratio   time@115200(s)')
+    for name, file_name, boot, args, init, expected in cases:
+      ram = bytearray(init)
+      sent = send(file_name, ram, boot, **args)
+      if ram != expected:
+        print(f'{name}: received file mismatch')
+        exit(1)
+      # each byte takes 10 bits on the wire
+      print(f'{name:12} {sent:<11} {sent / (len(expected) + 12):<7.2%} '
+            f'{sent * 10 / uart.baudrate:.1f}')